@@ -1,27 +1,61 @@
 #pragma once
 
 #include "Common.hpp"
+#include "Parallel.hpp"
 
-struct Adjacency {
-    // 存储每个边的一个直接邻接边，-1表示没有直接邻接
-    std::vector<int32> direct;
+#include <span>
+
+// 边的邻接关系，IndexType为direct中存储边索引的类型。
+// 接口中的边索引统一为int32，-1表示没有邻接，-2表示复杂连接，存储时映射为IndexType的最大的两个值
+template<typename IndexType>
+struct BasicAdjacency {
+    static_assert(std::is_unsigned_v<IndexType>, "BasicAdjacency only supports unsigned index types");
+
+    static constexpr IndexType NoneIndex    = static_cast<IndexType>(~IndexType(0));
+    static constexpr IndexType ComplexIndex = static_cast<IndexType>(~IndexType(0) - 1);
+
+    // 可以存储的最大边数
+    static constexpr size_t MaxNum = ComplexIndex;
+
+    // 存储每个边的一个直接邻接边，通过GetDirect和SetDirect访问
+    FirstTouchVector<IndexType> direct;
 
     // 存储额外的邻接关系，当一个边有多个邻接边时使用
     std::multimap<int32, int32> extended;
 
-    Adjacency(size_t num);
+    // Compact或LinkSorted之后的额外邻接关系，按边索引排序，同一条边的邻接保持插入顺序
+    std::vector<std::pair<int32, int32>> extended_compact;
+
+    BasicAdjacency(size_t num);
+
+    int32 GetDirect(int32 edge_index) const;
+    void  SetDirect(int32 edge_index, int32 adj_index);
+
     void AddUnique(int32 key, int32 value);
     void Link(int32 edge_index0, int32 edge_index1);
 
+    // 按顺序批量建立连接，结果与依次调用Link相同。只能在没有额外邻接关系时调用，之后不能再Link
+    void LinkSorted(std::span<const std::pair<int32, int32>> links);
+
+    // 所有连接建立完成后，将extended转换为紧凑的有序数组，遍历结果不变，之后不能再Link
+    void Compact();
+    void Free();
+
+    size_t GetAllocatedSize() const;
+
     template<typename FuncType>
     void ForAll(int32 edge_index, FuncType&& Function) const;
 };
 
+using Adjacency   = BasicAdjacency<uint32>;
+using Adjacency16 = BasicAdjacency<uint16>;
+
 // 遍历指定边的所有邻接边，并对每个邻接对应用给定函数
+template<typename IndexType>
 template<typename FuncType>
-inline void Adjacency::ForAll(int32 edge_index, FuncType&& Function) const {
+inline void BasicAdjacency<IndexType>::ForAll(int32 edge_index, FuncType&& Function) const {
     // 首先检查Direct数组中的直接邻接
-    int32 adj_index = direct[edge_index];
+    int32 adj_index = GetDirect(edge_index);
     if (adj_index >= 0) {
         // 对直接邻接应用函数
         Function(edge_index, adj_index);
@@ -33,15 +67,44 @@ inline void Adjacency::ForAll(int32 edge_index, FuncType&& Function) const {
         // 对每个额外邻接应用函数
         Function(edge_index, it->second);
     }
+
+    if (!extended_compact.empty()) {
+        auto it = std::lower_bound(
+            extended_compact.begin(),
+            extended_compact.end(),
+            edge_index,
+            [](const std::pair<int32, int32>& link, int32 key) { return link.first < key; }
+        );
+        for (; it != extended_compact.end() && it->first == edge_index; ++it) {
+            Function(edge_index, it->second);
+        }
+    }
 }
 
-inline Adjacency::Adjacency(size_t num) {
+template<typename IndexType>
+inline BasicAdjacency<IndexType>::BasicAdjacency(size_t num) {
+    CHECK(num <= MaxNum);
+
     // 初始化Direct数组，所有值设为-1表示尚未连接
-    direct.resize(num, -1);
+    FirstTouchFill(direct, num, NoneIndex);
+}
+
+template<typename IndexType>
+inline int32 BasicAdjacency<IndexType>::GetDirect(int32 edge_index) const {
+    const IndexType adj_index = direct[edge_index];
+    return adj_index == NoneIndex ? -1 : adj_index == ComplexIndex ? -2 : static_cast<int32>(adj_index);
+}
+
+template<typename IndexType>
+inline void BasicAdjacency<IndexType>::SetDirect(int32 edge_index, int32 adj_index) {
+    direct[edge_index] = adj_index == -1   ? NoneIndex
+                       : adj_index == -2 ? ComplexIndex
+                                         : static_cast<IndexType>(adj_index);
 }
 
 // 向Extended映射中添加键值对，确保不重复添加
-inline void Adjacency::AddUnique(int32 key, int32 value) {
+template<typename IndexType>
+inline void BasicAdjacency<IndexType>::AddUnique(int32 key, int32 value) {
     // 获取指定键的所有已存在值
     auto [begin, end] = extended.equal_range(key);
     bool found        = false;
@@ -63,14 +126,80 @@ inline void Adjacency::AddUnique(int32 key, int32 value) {
 // 在两个边之间建立邻接连接
 // 如果两个边都没有直接邻接边，则使用Direct数组存储它们之间的关系。
 // 否则，使用Extended多重映射存储它们之间的关系。
-inline void Adjacency::Link(int32 edge_index0, int32 edge_index1) {
+template<typename IndexType>
+inline void BasicAdjacency<IndexType>::Link(int32 edge_index0, int32 edge_index1) {
+    CHECK(extended_compact.empty());
+
     // 如果两个边都没有直接邻接边，使用Direct数组连接它们
-    if (direct[edge_index0] < 0 && direct[edge_index1] < 0) {
-        direct[edge_index0] = edge_index1;
-        direct[edge_index1] = edge_index0;
+    if (GetDirect(edge_index0) < 0 && GetDirect(edge_index1) < 0) {
+        SetDirect(edge_index0, edge_index1);
+        SetDirect(edge_index1, edge_index0);
     } else {
         // 否则使用Extended存储它们之间的连接关系
         AddUnique(edge_index0, edge_index1);
         AddUnique(edge_index1, edge_index0);
     }
-}
\ No newline at end of file
+}
+
+template<typename IndexType>
+inline void BasicAdjacency<IndexType>::LinkSorted(std::span<const std::pair<int32, int32>> links) {
+    CHECK(extended.empty() && extended_compact.empty());
+
+    // 直接邻接依赖于之前的连接，按顺序建立，其余连接直接写入紧凑数组，不逐个分配multimap节点
+    for (const auto& [edge_index0, edge_index1]: links) {
+        if (GetDirect(edge_index0) < 0 && GetDirect(edge_index1) < 0) {
+            SetDirect(edge_index0, edge_index1);
+            SetDirect(edge_index1, edge_index0);
+        } else {
+            extended_compact.emplace_back(edge_index0, edge_index1);
+            extended_compact.emplace_back(edge_index1, edge_index0);
+        }
+    }
+
+    // 按边稳定排序，同一条边的邻接保持插入顺序，再去掉重复的连接，与逐个AddUnique的结果相同
+    std::stable_sort(
+        extended_compact.begin(),
+        extended_compact.end(),
+        [](const std::pair<int32, int32>& a, const std::pair<int32, int32>& b) { return a.first < b.first; }
+    );
+
+    size_t num_unique  = 0;
+    size_t group_begin = 0;
+    for (size_t i = 0; i < extended_compact.size(); i++) {
+        const std::pair<int32, int32> link = extended_compact[i];
+        if (num_unique == 0 || extended_compact[num_unique - 1].first != link.first) {
+            group_begin = num_unique;
+        }
+
+        const auto group_end = extended_compact.begin() + num_unique;
+        if (std::find(extended_compact.begin() + group_begin, group_end, link) == group_end) {
+            extended_compact[num_unique++] = link;
+        }
+    }
+    extended_compact.resize(num_unique);
+}
+
+template<typename IndexType>
+inline void BasicAdjacency<IndexType>::Compact() {
+    // multimap按key有序，相同key按插入顺序排列，直接拷贝即可保持ForAll的遍历顺序
+    extended_compact.reserve(extended_compact.size() + extended.size());
+    extended_compact.insert(extended_compact.end(), extended.begin(), extended.end());
+    extended.clear();
+}
+
+template<typename IndexType>
+inline void BasicAdjacency<IndexType>::Free() {
+    direct.clear();
+    direct.shrink_to_fit();
+    extended.clear();
+    extended_compact.clear();
+    extended_compact.shrink_to_fit();
+}
+
+// multimap每个节点除了键值对还有父、左、右指针和颜色
+template<typename IndexType>
+inline size_t BasicAdjacency<IndexType>::GetAllocatedSize() const {
+    const size_t extended_node_size = sizeof(std::multimap<int32, int32>::value_type) + 4 * sizeof(void*);
+    return direct.capacity() * sizeof(IndexType) + extended.size() * extended_node_size +
+           extended_compact.capacity() * sizeof(std::pair<int32, int32>);
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Parallel.hpp"
+#include "MeshLoader.hpp"
+#include "ClusterBuilder.hpp"
+#include "ClusterCache.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+struct BatchInput {
+    std::filesystem::path source; // 网格文件路径
+    std::filesystem::path output; // 相对于输出目录的路径
+};
+
+struct BatchBuildSettings {
+    ClusterBuildSettings  cluster_settings;
+    std::filesystem::path output_directory;
+    const ClusterCache*   cache = nullptr;
+    BuildStats*           stats = nullptr; // 所有网格的阶段统计合并到一起
+
+    // 流水线构建：加载线程读取和解析网格，线程池构建cluster，写出线程编码和写入磁盘，
+    // 三个阶段同时处理不同的网格，读写的等待不占用构建的线程。关闭时每个任务依次完成一个网格的全部步骤
+    bool   pipelined         = false;
+    uint32 num_load_threads  = 2;
+    uint32 num_write_threads = 1;
+    // 已开始加载但还没有写出的网格的内存上限，按源文件大小估计，不包括构建过程中的临时内存
+    uint64 pipeline_memory = 1ull << 30;
+};
+
+struct BatchBuildResult {
+    std::filesystem::path source;
+    uint32                num_triangles = 0;
+    uint32                num_clusters  = 0;
+    bool                  cache_hit     = false;
+    bool                  succeeded     = false;
+    std::string           error;
+};
+
+inline static bool IsBatchMeshFile(const std::filesystem::path& path) {
+    return path.extension() == ".obj";
+}
+
+// 输入路径能否安全地映射到输出目录内的相同相对路径
+inline static bool IsContainedRelativePath(const std::filesystem::path& path) {
+    if (path.empty() || !path.is_relative()) {
+        return false;
+    }
+    for (const auto& part: path) {
+        if (part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 收集批量构建的输入，input可以是目录（递归查找网格）、清单文件（每行一个路径，#开头为注释）或单个网格
+inline std::vector<BatchInput> CollectBatchInputs(const std::filesystem::path& input) {
+    std::vector<BatchInput> inputs;
+
+    // 相对路径在输出目录中保持相同的结构，绝对路径或跳出输入目录的路径使用文件名加完整路径的哈希，避免重名覆盖
+    auto MakeOutputPath = [](const std::filesystem::path& source, std::filesystem::path relative) {
+        relative = relative.lexically_normal();
+        if (!IsContainedRelativePath(relative)) {
+            const std::string full_path = std::filesystem::absolute(source).lexically_normal().generic_string();
+            const Hash128     hash      = Murmur128(full_path.data(), full_path.size());
+            relative = source.stem().string() + "-" + hash.ToString().substr(0, 16) + source.extension().string();
+        }
+        return relative.replace_extension(".clusters");
+    };
+
+    if (std::filesystem::is_directory(input)) {
+        for (const auto& entry: std::filesystem::recursive_directory_iterator(input)) {
+            if (entry.is_regular_file() && IsBatchMeshFile(entry.path())) {
+                const std::filesystem::path relative = entry.path().lexically_relative(input);
+                inputs.push_back({ entry.path(), MakeOutputPath(entry.path(), relative) });
+            }
+        }
+    } else if (IsBatchMeshFile(input)) {
+        inputs.push_back({ input, MakeOutputPath(input, input.filename()) });
+    } else {
+        std::ifstream manifest(input);
+        if (!manifest) {
+            throw std::runtime_error("failed to open manifest " + input.string());
+        }
+
+        std::string line;
+        while (std::getline(manifest, line)) {
+            // 去掉首尾空白
+            line.erase(0, line.find_first_not_of(" \t\r"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            // 相对路径相对于清单文件所在目录
+            std::filesystem::path path   = line;
+            std::filesystem::path source = path.is_relative() ? input.parent_path() / path : path;
+            inputs.push_back({ source, MakeOutputPath(source, path) });
+        }
+    }
+
+    // 保证每次构建的顺序一致
+    std::sort(inputs.begin(), inputs.end(), [](const BatchInput& a, const BatchInput& b) {
+        return a.source < b.source;
+    });
+
+    // 并发的任务写同一个输出文件会互相覆盖，提前拒绝
+    std::vector<std::filesystem::path> outputs;
+    outputs.reserve(inputs.size());
+    for (const auto& batch_input: inputs) {
+        outputs.push_back(batch_input.output);
+    }
+    std::sort(outputs.begin(), outputs.end());
+    auto duplicate = std::adjacent_find(outputs.begin(), outputs.end());
+    if (duplicate != outputs.end()) {
+        throw std::runtime_error("multiple inputs map to output " + duplicate->string());
+    }
+
+    return inputs;
+}
+
+// 已加载的网格和构建出的cluster，在流水线的阶段之间传递
+struct BatchMesh {
+    uint32               index = 0; // 在输入中的位置
+    uint64               bytes = 0; // 在流水线内存预算中占用的大小
+    MeshData             mesh;
+    std::vector<Cluster> clusters;
+    ClusterPartition     partition;
+    Hash128              key;
+};
+
+inline bool LoadBatchMesh(
+    const BatchInput&         input,
+    const BatchBuildSettings& settings,
+    BatchMesh&                batch_mesh,
+    BatchBuildResult&         result
+) {
+    BuildStageScope stage(settings.stats, "Load");
+
+    MeshLoader loader;
+    if (!loader.Load(input.source.string(), batch_mesh.mesh)) {
+        result.error = loader.GetError();
+        return false;
+    }
+    result.num_triangles = batch_mesh.mesh.NumTriangles();
+    return true;
+}
+
+// 构建cluster后释放网格数据
+inline void ClusterBatchMesh(const BatchBuildSettings& settings, BatchMesh& batch_mesh, BatchBuildResult& result) {
+    MeshData& mesh   = batch_mesh.mesh;
+    result.cache_hit = ClusterTrianglesCached(
+        settings.cache,
+        mesh.verts,
+        mesh.indices,
+        mesh.material_indexes,
+        batch_mesh.clusters,
+        mesh.bounds,
+        settings.cluster_settings,
+        &batch_mesh.partition,
+        &batch_mesh.key,
+        settings.stats
+    );
+    result.num_clusters = static_cast<uint32>(batch_mesh.clusters.size());
+
+    mesh = {};
+}
+
+inline bool WriteBatchMesh(
+    const BatchInput&         input,
+    const BatchBuildSettings& settings,
+    const BatchMesh&          batch_mesh,
+    BatchBuildResult&         result
+) {
+    BuildStageScope stage(settings.stats, "Write");
+
+    const std::filesystem::path output_path = settings.output_directory / input.output;
+
+    std::error_code error;
+    std::filesystem::create_directories(output_path.parent_path(), error);
+
+    std::ofstream out(output_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        result.error = "failed to open " + output_path.string();
+        return false;
+    }
+
+    const auto& clusters = batch_mesh.clusters;
+    WriteClusterBlob(out, batch_mesh.key, clusters.data(), clusters.size(), batch_mesh.partition);
+    if (!out) {
+        result.error = "failed to write " + output_path.string();
+        return false;
+    }
+
+    result.succeeded = true;
+    return true;
+}
+
+// 构建单个网格并直接写入磁盘，构建完成后网格和cluster数据随即释放
+inline BatchBuildResult BuildBatchMesh(const BatchInput& input, const BatchBuildSettings& settings) {
+    BatchBuildResult result;
+    result.source = input.source;
+
+    BatchMesh batch_mesh;
+    if (LoadBatchMesh(input, settings, batch_mesh, result)) {
+        ClusterBatchMesh(settings, batch_mesh, result);
+        WriteBatchMesh(input, settings, batch_mesh, result);
+    }
+    return result;
+}
+
+// 按文件大小从大到小排列输入，先调度大的网格，避免最后只剩一个大网格拖慢整个批次
+inline std::vector<uint32> GetBatchOrder(const std::vector<BatchInput>& inputs, std::vector<uintmax_t>& file_sizes) {
+    file_sizes.resize(inputs.size());
+    std::vector<uint32> order(inputs.size());
+    for (uint32 i = 0; i < inputs.size(); i++) {
+        std::error_code error;
+        file_sizes[i] = std::filesystem::file_size(inputs[i].source, error);
+        file_sizes[i] = error ? 0 : file_sizes[i];
+        order[i]      = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&file_sizes](uint32 a, uint32 b) {
+        return file_sizes[a] > file_sizes[b];
+    });
+    return order;
+}
+
+// 流水线构建，见BatchBuildSettings::pipelined。加载线程按输入的顺序读取网格，每加载完一个就放入线程池构建，
+// 构建完成后交给写出线程。线程池中没有等待加载的任务，空闲的线程可以帮助正在构建的网格的ParallelFor
+inline std::vector<BatchBuildResult> BuildBatchPipelined(
+    const std::vector<BatchInput>& inputs,
+    const BatchBuildSettings&      settings
+) {
+    std::vector<BatchBuildResult> results(inputs.size());
+    for (uint32 i = 0; i < inputs.size(); i++) {
+        results[i].source = inputs[i].source;
+    }
+
+    std::vector<uintmax_t>    file_sizes;
+    const std::vector<uint32> order = GetBatchOrder(inputs, file_sizes);
+
+    MemoryBudget                          budget(settings.pipeline_memory);
+    TaskGroup                             group;
+    WorkQueue<std::shared_ptr<BatchMesh>> built_queue;
+
+    auto SetError = [&results](uint32 index, const std::exception& exception) {
+        results[index].succeeded = false;
+        results[index].error     = exception.what();
+    };
+
+    auto BuildTask = [&](std::shared_ptr<BatchMesh> batch_mesh) {
+        try {
+            ClusterBatchMesh(settings, *batch_mesh, results[batch_mesh->index]);
+            built_queue.Push(std::move(batch_mesh));
+        } catch (const std::exception& exception) {
+            SetError(batch_mesh->index, exception);
+            budget.Release(batch_mesh->bytes);
+        }
+    };
+
+    std::atomic<uint32> next_input { 0 };
+    auto                LoadThread = [&]() {
+        for (uint32 i = next_input++; i < order.size(); i = next_input++) {
+            auto batch_mesh   = std::make_shared<BatchMesh>();
+            batch_mesh->index = order[i];
+            batch_mesh->bytes = std::max<uint64>(file_sizes[order[i]], 1);
+
+            budget.Acquire(batch_mesh->bytes);
+            bool loaded = false;
+            try {
+                loaded = LoadBatchMesh(inputs[batch_mesh->index], settings, *batch_mesh, results[batch_mesh->index]);
+            } catch (const std::exception& exception) {
+                SetError(batch_mesh->index, exception);
+            }
+
+            if (loaded) {
+                group.Run([&BuildTask, batch_mesh] { BuildTask(batch_mesh); });
+            } else {
+                budget.Release(batch_mesh->bytes);
+            }
+        }
+    };
+
+    auto WriteThread = [&]() {
+        while (std::optional<std::shared_ptr<BatchMesh>> batch_mesh = built_queue.Pop()) {
+            const uint32 index = (*batch_mesh)->index;
+            try {
+                WriteBatchMesh(inputs[index], settings, **batch_mesh, results[index]);
+            } catch (const std::exception& exception) {
+                SetError(index, exception);
+            }
+
+            const uint64 bytes = (*batch_mesh)->bytes;
+            batch_mesh->reset();
+            budget.Release(bytes);
+        }
+    };
+
+    std::vector<std::thread> load_threads;
+    std::vector<std::thread> write_threads;
+    for (uint32 i = 0; i < std::max(1u, settings.num_load_threads); i++) {
+        load_threads.emplace_back(LoadThread);
+    }
+    for (uint32 i = 0; i < std::max(1u, settings.num_write_threads); i++) {
+        write_threads.emplace_back(WriteThread);
+    }
+
+    // 所有网格都放入线程池之后才能等待构建完成
+    for (auto& thread: load_threads) {
+        thread.join();
+    }
+    group.Wait();
+
+    built_queue.Close();
+    for (auto& thread: write_threads) {
+        thread.join();
+    }
+
+    if (settings.stats) {
+        settings.stats->MaxCounter("Pipeline.PeakBytes", budget.GetPeak());
+    }
+    return results;
+}
+
+// 将网格的完整构建作为任务放入共享线程池，大网格在内部的ParallelFor中继续拆分
+inline std::vector<BatchBuildResult> BuildBatch(
+    const std::vector<BatchInput>& inputs,
+    const BatchBuildSettings&      settings
+) {
+    if (settings.pipelined) {
+        return BuildBatchPipelined(inputs, settings);
+    }
+
+    std::vector<BatchBuildResult> results(inputs.size());
+
+    std::vector<uintmax_t>    file_sizes;
+    const std::vector<uint32> order = GetBatchOrder(inputs, file_sizes);
+
+    // 每个线程一个任务，任务循环领取下一个网格，同时构建的网格数不超过线程数。
+    // 网格内部的ParallelFor等待时只会执行自己的批次，不会转而构建其他网格
+    std::atomic<uint32> next_input { 0 };
+    auto                BuildTask = [&]() {
+        for (uint32 i = next_input++; i < order.size(); i = next_input++) {
+            const uint32 index = order[i];
+            try {
+                results[index] = BuildBatchMesh(inputs[index], settings);
+            } catch (const std::exception& exception) {
+                results[index].source = inputs[index].source;
+                results[index].error  = exception.what();
+            }
+        }
+    };
+
+    TaskGroup group;
+    for (uint32 i = 0, num_tasks = ThreadPool::Get().NumWorkers() + 1; i < num_tasks; i++) {
+        group.Run(BuildTask);
+    }
+    group.Wait();
+
+    return results;
+}
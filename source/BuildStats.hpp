@@ -0,0 +1,222 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+#endif
+
+// 进程当前和历史峰值的常驻内存，无法获取时返回0
+struct ProcessMemory {
+    uint64 resident      = 0;
+    uint64 peak_resident = 0;
+
+    static ProcessMemory Query();
+};
+
+inline ProcessMemory ProcessMemory::Query() {
+    ProcessMemory memory;
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        memory.resident      = counters.WorkingSetSize;
+        memory.peak_resident = counters.PeakWorkingSetSize;
+    }
+#else
+    // VmRSS和VmHWM的单位是kB
+    std::ifstream status("/proc/self/status");
+    std::string   line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            memory.resident = std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+        } else if (line.rfind("VmHWM:", 0) == 0) {
+            memory.peak_resident = std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+        }
+    }
+#endif
+    return memory;
+}
+
+// 单个构建阶段的耗时和内存，同名阶段多次执行时耗时累加，内存取最大值
+struct BuildStageStats {
+    std::string name;
+    uint32      count          = 0;
+    double      seconds        = 0.0;
+    uint64      tracked_bytes  = 0; // 阶段结束时仍然存活的主要数据结构的分配大小
+    uint64      resident_begin = 0;
+    uint64      resident_end   = 0;
+    uint64      peak_resident  = 0; // 阶段结束时进程的峰值常驻内存
+};
+
+// 按阶段收集构建统计，多个网格并行构建时可以共享同一个实例，同名阶段会被合并
+class BuildStats {
+public:
+    void AddStage(BuildStageStats stage);
+    // 累加一个计数，同名计数求和
+    void AddCounter(const std::string& name, uint64 value);
+    // 记录一个计数的最大值，同名计数取最大
+    void MaxCounter(const std::string& name, uint64 value);
+
+    std::vector<BuildStageStats>                GetStages() const;
+    std::vector<std::pair<std::string, uint64>> GetCounters() const;
+    // 指定名字的计数，没有记录时为0
+    uint64 GetCounter(const std::string& name) const;
+
+    // 每个阶段一行，内存以MB为单位
+    void Print(std::ostream& out) const;
+
+private:
+    mutable std::mutex                          m_mutex;
+    std::vector<BuildStageStats>                m_stages;
+    std::vector<std::pair<std::string, uint64>> m_counters;
+};
+
+inline void BuildStats::AddStage(BuildStageStats stage) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_stages.begin(), m_stages.end(), [&stage](const BuildStageStats& other) {
+        return other.name == stage.name;
+    });
+    if (it == m_stages.end()) {
+        stage.count = 1;
+        m_stages.push_back(std::move(stage));
+        return;
+    }
+
+    it->count++;
+    it->seconds += stage.seconds;
+
+    it->tracked_bytes  = std::max(it->tracked_bytes, stage.tracked_bytes);
+    it->resident_begin = std::max(it->resident_begin, stage.resident_begin);
+    it->resident_end   = std::max(it->resident_end, stage.resident_end);
+    it->peak_resident  = std::max(it->peak_resident, stage.peak_resident);
+}
+
+inline void BuildStats::AddCounter(const std::string& name, uint64 value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_counters.begin(), m_counters.end(), [&name](const auto& counter) {
+        return counter.first == name;
+    });
+    if (it == m_counters.end()) {
+        m_counters.emplace_back(name, value);
+    } else {
+        it->second += value;
+    }
+}
+
+inline void BuildStats::MaxCounter(const std::string& name, uint64 value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_counters.begin(), m_counters.end(), [&name](const auto& counter) {
+        return counter.first == name;
+    });
+    if (it == m_counters.end()) {
+        m_counters.emplace_back(name, value);
+    } else {
+        it->second = std::max(it->second, value);
+    }
+}
+
+inline std::vector<BuildStageStats> BuildStats::GetStages() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stages;
+}
+
+inline std::vector<std::pair<std::string, uint64>> BuildStats::GetCounters() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_counters;
+}
+
+inline uint64 BuildStats::GetCounter(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_counters.begin(), m_counters.end(), [&name](const auto& counter) {
+        return counter.first == name;
+    });
+    return it == m_counters.end() ? 0 : it->second;
+}
+
+inline void BuildStats::Print(std::ostream& out) const {
+    auto ToMB = [](uint64 bytes) { return static_cast<double>(bytes) / (1024.0 * 1024.0); };
+
+    char line[256];
+    std::snprintf(
+        line,
+        sizeof(line),
+        "%-24s %6s %10s %12s %12s %12s\n",
+        "stage",
+        "count",
+        "ms",
+        "tracked MB",
+        "rss MB",
+        "peak rss MB"
+    );
+    out << line;
+
+    for (const auto& stage: GetStages()) {
+        std::snprintf(
+            line,
+            sizeof(line),
+            "%-24s %6u %10.2f %12.2f %12.2f %12.2f\n",
+            stage.name.c_str(),
+            stage.count,
+            stage.seconds * 1000.0,
+            ToMB(stage.tracked_bytes),
+            ToMB(stage.resident_end),
+            ToMB(stage.peak_resident)
+        );
+        out << line;
+    }
+
+    for (const auto& [name, value]: GetCounters()) {
+        std::snprintf(line, sizeof(line), "%-24s %llu\n", name.c_str(), static_cast<unsigned long long>(value));
+        out << line;
+    }
+}
+
+// 在作用域内统计一个阶段，stats为空时不做任何事
+class BuildStageScope {
+public:
+    BuildStageScope(BuildStats* stats, const char* name): m_stats(stats) {
+        if (m_stats) {
+            m_stage.name           = name;
+            m_stage.resident_begin = ProcessMemory::Query().resident;
+            m_start                = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~BuildStageScope() {
+        if (m_stats) {
+            const ProcessMemory memory = ProcessMemory::Query();
+
+            m_stage.seconds       = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+            m_stage.resident_end  = memory.resident;
+            m_stage.peak_resident = memory.peak_resident;
+            m_stats->AddStage(std::move(m_stage));
+        }
+    }
+
+    BuildStageScope(const BuildStageScope&)            = delete;
+    BuildStageScope& operator=(const BuildStageScope&) = delete;
+
+    // 记录阶段结束时存活的数据结构大小
+    void Track(uint64 bytes) {
+        if (m_stats) {
+            m_stage.tracked_bytes += bytes;
+        }
+    }
+
+private:
+    BuildStats*                           m_stats;
+    BuildStageStats                       m_stage;
+    std::chrono::steady_clock::time_point m_start;
+};
@@ -2,11 +2,37 @@
 
 #include "Common.hpp"
 #include "VectorMath.hpp"
+#include "StridedView.hpp"
 #include "Math/BoundingBox.hpp"
 
+#include <span>
+
+struct MeshBuildVertexView {
+    std::vector<Point3f> Positions;
+};
+
 class Cluster {
 public:
     Cluster() {}
+    Cluster(
+        const MeshBuildVertexView& in_verts,
+        const std::vector<uint32>& in_indexes,
+        const std::vector<int32>&  in_material_indexes,
+        uint32                     tri_begin,
+        uint32                     tri_end,
+        const std::vector<uint32>& tri_indexes
+    );
+
+    // 直接引用调用方的顶点和索引缓冲，支持16位和32位索引
+    template<typename IndexType>
+    Cluster(
+        ConstStridedView<Vector3f> in_positions,
+        std::span<const IndexType> in_indexes,
+        std::span<const int32>     in_material_indexes,
+        uint32                     tri_begin,
+        uint32                     tri_end,
+        const std::vector<uint32>& tri_indexes
+    );
 
 public:
     Vector3f& GetPosition(uint32 vertIndex);
@@ -19,6 +45,11 @@ public:
     const Vector3f& GetUVs(uint32 vertIndex) const;
     const Vector3f& GetColor(uint32 vertIndex) const;
 
+    // 每个顶点在Verts中占用的float数量，目前只有位置
+    static uint32 GetVertSize() { return 3; }
+
+    void Bound();
+
     static const uint16_t ClusterSize = 128;
 
     uint32 NumVerts = 0;
@@ -32,3 +63,77 @@ public:
     uint64_t GUID     = 0;
     int32    MipLevel = 0;
 };
+
+inline Cluster::Cluster(
+    const MeshBuildVertexView& in_verts,
+    const std::vector<uint32>& in_indexes,
+    const std::vector<int32>&  in_material_indexes,
+    uint32                     tri_begin,
+    uint32                     tri_end,
+    const std::vector<uint32>& tri_indexes
+):
+    Cluster(
+        MakeConstStridedView(in_verts.Positions),
+        std::span<const uint32>(in_indexes),
+        std::span<const int32>(in_material_indexes),
+        tri_begin,
+        tri_end,
+        tri_indexes
+    ) {}
+
+// 从划分结果中提取[tri_begin, tri_end)范围内的三角形，并将顶点重映射为cluster内的局部索引
+template<typename IndexType>
+inline Cluster::Cluster(
+    ConstStridedView<Vector3f> in_positions,
+    std::span<const IndexType> in_indexes,
+    std::span<const int32>     in_material_indexes,
+    uint32                     tri_begin,
+    uint32                     tri_end,
+    const std::vector<uint32>& tri_indexes
+) {
+    NumTris = tri_end - tri_begin;
+
+    Verts.reserve(NumTris * GetVertSize());
+    Indexes.reserve(NumTris * 3);
+    MaterialIndexes.reserve(NumTris);
+
+    // 全局顶点索引到局部顶点索引的映射
+    std::unordered_map<uint32, uint32> old_to_new_index;
+    old_to_new_index.reserve(NumTris * 3);
+
+    for (uint32 i = tri_begin; i < tri_end; i++) {
+        uint32 tri_index = tri_indexes[i];
+
+        for (uint32 k = 0; k < 3; k++) {
+            uint32 old_index = in_indexes[tri_index * 3 + k];
+
+            auto [it, inserted] = old_to_new_index.try_emplace(old_index, NumVerts);
+            if (inserted) {
+                // 首次出现的顶点，拷贝其属性
+                Verts.resize(Verts.size() + GetVertSize());
+                GetPosition(NumVerts) = in_positions[static_cast<int32>(old_index)];
+                NumVerts++;
+            }
+
+            Indexes.push_back(it->second);
+        }
+
+        MaterialIndexes.push_back(in_material_indexes.empty() ? 0 : in_material_indexes[tri_index]);
+    }
+}
+
+inline Vector3f& Cluster::GetPosition(uint32 vertIndex) {
+    return *reinterpret_cast<Vector3f*>(&Verts[vertIndex * GetVertSize()]);
+}
+
+inline const Vector3f& Cluster::GetPosition(uint32 vertIndex) const {
+    return *reinterpret_cast<const Vector3f*>(&Verts[vertIndex * GetVertSize()]);
+}
+
+// 计算cluster所有顶点的包围盒
+inline void Cluster::Bound() {
+    Bounds = Bounds3f();
+    for (uint32 i = 0; i < NumVerts; i++) {
+        Bounds.AddPoint(GetPosition(i));
+    }
+}
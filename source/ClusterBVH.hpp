@@ -0,0 +1,592 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "Parallel.hpp"
+#include "GraphPartitioner.hpp"
+
+#include <span>
+
+struct ClusterSphere {
+    Vector3f center;
+    float    radius = 0.0f;
+};
+
+// 包含两个球的最小球
+inline ClusterSphere MergeSpheres(const ClusterSphere& a, const ClusterSphere& b) {
+    const Vector3f offset   = b.center - a.center;
+    const float    distance = offset.Length();
+    if (distance + b.radius <= a.radius) {
+        return a;
+    }
+    if (distance + a.radius <= b.radius) {
+        return b;
+    }
+
+    ClusterSphere sphere;
+    sphere.radius = 0.5f * (distance + a.radius + b.radius);
+    sphere.center = a.center + offset * ((sphere.radius - a.radius) / distance);
+    return sphere;
+}
+
+// 以包围盒中心为球心的包围球
+inline ClusterSphere ComputeClusterSphere(const Cluster& cluster) {
+    ClusterSphere sphere;
+    sphere.center = cluster.Bounds.GetCenter();
+
+    float radius2 = 0.0f;
+    for (uint32 i = 0; i < cluster.NumVerts; i++) {
+        radius2 = std::max(radius2, Math::Vector3::DistanceSquared(sphere.center, cluster.GetPosition(i)));
+    }
+    sphere.radius = std::sqrt(radius2);
+    return sphere;
+}
+
+struct ClusterBVHSettings {
+    uint32 max_leaf_size = 4; // 叶子中最多的cluster数
+    uint32 num_bins      = 32; // SAH分箱数
+
+    // 元素数少于该值的子树改用按莫顿码排序的LBVH构建
+    uint32 linear_threshold = 4096;
+};
+
+// 8叉BVH节点，按SoA存储，一次可以用SIMD测试全部8个子节点。
+// 空的子节点包围盒为空（min大于max），任何相交测试都会失败
+struct alignas(32) ClusterBVH8Node {
+    static constexpr uint32 Width = 8;
+
+    float min_x[Width];
+    float min_y[Width];
+    float min_z[Width];
+    float max_x[Width];
+    float max_y[Width];
+    float max_z[Width];
+
+    float sphere_x[Width];
+    float sphere_y[Width];
+    float sphere_z[Width];
+    float sphere_radius[Width];
+
+    uint32 child[Width]; // 内部节点为子节点索引，叶子为cluster_indices中的起始位置，空为~0u
+    uint8  num_clusters[Width]; // 0表示内部节点
+};
+
+struct ClusterBVH {
+    std::vector<ClusterBVH8Node> nodes; // 根节点为0
+    std::vector<uint32>          cluster_indices; // 叶子引用的cluster索引
+
+    // 访问与box相交的叶子中的所有cluster，结果是保守的，需要时由调用方再逐个测试
+    template<typename FuncType>
+    void Query(const Bounds3f& box, FuncType&& Visit) const;
+};
+
+template<typename FuncType>
+inline void ClusterBVH::Query(const Bounds3f& box, FuncType&& Visit) const {
+    if (nodes.empty()) {
+        return;
+    }
+
+    const Vector3f box_min = box.GetMin();
+    const Vector3f box_max = box.GetMax();
+
+    std::vector<uint32> stack = { 0 };
+    while (!stack.empty()) {
+        const ClusterBVH8Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        // 8个子节点的相交测试没有分支，编译器可以向量化
+        bool overlap[ClusterBVH8Node::Width];
+        for (uint32 i = 0; i < ClusterBVH8Node::Width; i++) {
+            overlap[i] = (node.min_x[i] <= box_max.x) & (node.max_x[i] >= box_min.x) & (node.min_y[i] <= box_max.y) &
+                         (node.max_y[i] >= box_min.y) & (node.min_z[i] <= box_max.z) & (node.max_z[i] >= box_min.z);
+        }
+
+        for (uint32 i = 0; i < ClusterBVH8Node::Width; i++) {
+            if (!overlap[i]) {
+                continue;
+            }
+            if (node.num_clusters[i] == 0) {
+                stack.push_back(node.child[i]);
+            } else {
+                for (uint32 k = 0; k < node.num_clusters[i]; k++) {
+                    Visit(cluster_indices[node.child[i] + k]);
+                }
+            }
+        }
+    }
+}
+
+inline float GetAxis(const Vector3f& v, uint32 axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// 合并两个包围盒，任意一个可以为空。AddBoundingBox会把空包围盒的两个角点当作普通的点加入
+inline Bounds3f MergeBounds(const Bounds3f& a, const Bounds3f& b) {
+    return Bounds3f(Vector3f::Min(a.GetMin(), b.GetMin()), Vector3f::Max(a.GetMax(), b.GetMax()));
+}
+
+// 包围盒表面积的一半，SAH中只需要比例
+inline float HalfSurfaceArea(const Bounds3f& bounds) {
+    const Vector3f size = bounds.GetDimensions();
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+// 顶层用并行的分箱SAH划分，元素数少于linear_threshold的子树按莫顿码排序后用LBVH构建，
+// 得到的二叉树最后按表面积展开合并为8叉树
+class ClusterBVHBuilder {
+public:
+    ClusterBVHBuilder(
+        std::span<const Bounds3f>      bounds,
+        std::span<const ClusterSphere> spheres,
+        const ClusterBVHSettings&      settings
+    );
+
+    ClusterBVH Build();
+
+private:
+    struct BinaryNode {
+        Bounds3f      bounds;
+        ClusterSphere sphere;
+        uint32        begin;
+        uint32        end;
+        uint32        children[2]; // 叶子为~0u
+    };
+
+    // 构建时原地划分的元素，包围盒和中心与索引放在一起，划分和分箱时顺序访问内存
+    struct BuildPrim {
+        Bounds3f bounds;
+        Vector3f centroid;
+        uint32   index;
+    };
+
+    struct Bin {
+        Bounds3f bounds;
+        uint32   count = 0;
+    };
+
+    // 元素数不少于该值时并行计算包围盒和分箱
+    static constexpr uint32 ParallelGrain = 64 * 1024;
+    // 元素数不少于该值的子树作为单独的任务构建
+    static constexpr uint32 TaskGrain = 4 * 1024;
+
+    uint32 AllocateNodes(uint32 num) { return m_num_nodes.fetch_add(num); }
+
+    void MakeLeaf(uint32 node_index, uint32 begin, uint32 end);
+
+    Bounds3f ComputeCentroidBounds(uint32 begin, uint32 end) const;
+
+    void BuildBinned(TaskGroup& group, uint32 node_index, uint32 begin, uint32 end);
+    void BuildLinear(uint32 node_index, uint32 begin, uint32 end);
+    void BuildLinearNode(uint32 node_index, uint32 begin, uint32 end, const std::vector<uint32>& codes, uint32 base);
+
+    // 按节点索引倒序自底向上计算包围盒和包围球，子节点的索引总是大于父节点
+    void Refit();
+
+    void Collapse(ClusterBVH& bvh) const;
+
+    std::span<const Bounds3f>      m_bounds;
+    std::span<const ClusterSphere> m_spheres;
+    ClusterBVHSettings             m_settings;
+
+    std::vector<BuildPrim>  m_prims; // 叶子按区间引用
+    std::vector<BinaryNode> m_nodes;
+    std::atomic<uint32>     m_num_nodes { 0 };
+};
+
+inline ClusterBVHBuilder::ClusterBVHBuilder(
+    std::span<const Bounds3f>      bounds,
+    std::span<const ClusterSphere> spheres,
+    const ClusterBVHSettings&      settings
+):
+    m_bounds(bounds),
+    m_spheres(spheres),
+    m_settings(settings) {
+    CHECK(bounds.size() == spheres.size() && bounds.size() < UINT32_MAX / 2);
+    CHECK(settings.max_leaf_size >= 1 && settings.max_leaf_size <= 255);
+    CHECK(settings.num_bins >= 2);
+}
+
+inline ClusterBVH ClusterBVHBuilder::Build() {
+    ClusterBVH   bvh;
+    const uint32 num_clusters = static_cast<uint32>(m_bounds.size());
+    if (num_clusters == 0) {
+        return bvh;
+    }
+
+    m_prims.resize(num_clusters);
+    ParallelFor("ClusterBVH.ParallelFor", num_clusters, 4096, [&](size_t index) {
+        m_prims[index] = { m_bounds[index], m_bounds[index].GetCenter(), static_cast<uint32>(index) };
+    });
+
+    // 每个内部节点有两个子节点且叶子非空，节点数不超过2n-1
+    m_nodes.resize(size_t(num_clusters) * 2);
+    m_num_nodes = 0;
+
+    const uint32 root = AllocateNodes(1);
+    {
+        TaskGroup group;
+        BuildBinned(group, root, 0, num_clusters);
+        group.Wait();
+    }
+
+    m_nodes.resize(m_num_nodes);
+    Refit();
+    Collapse(bvh);
+
+    bvh.cluster_indices.resize(num_clusters);
+    for (uint32 i = 0; i < num_clusters; i++) {
+        bvh.cluster_indices[i] = m_prims[i].index;
+    }
+    m_prims.clear();
+    return bvh;
+}
+
+inline void ClusterBVHBuilder::MakeLeaf(uint32 node_index, uint32 begin, uint32 end) {
+    BinaryNode& node = m_nodes[node_index];
+    node.begin       = begin;
+    node.end         = end;
+    node.children[0] = ~0u;
+    node.children[1] = ~0u;
+}
+
+inline Bounds3f ClusterBVHBuilder::ComputeCentroidBounds(uint32 begin, uint32 end) const {
+    auto ComputeRange = [this](uint32 range_begin, uint32 range_end) {
+        Bounds3f bounds;
+        for (uint32 i = range_begin; i < range_end; i++) {
+            bounds.AddPoint(m_prims[i].centroid);
+        }
+        return bounds;
+    };
+
+    if (end - begin < ParallelGrain) {
+        return ComputeRange(begin, end);
+    }
+
+    // 分块并行计算后按块的顺序合并
+    const uint32          chunk_size = ParallelGrain / 4;
+    std::vector<Bounds3f> chunk_bounds(DivideAndRoundUp(end - begin, chunk_size));
+    ParallelFor("ClusterBVH.ParallelFor", chunk_bounds.size(), 1, [&](size_t chunk) {
+        const uint32 chunk_begin = begin + static_cast<uint32>(chunk) * chunk_size;
+        chunk_bounds[chunk]      = ComputeRange(chunk_begin, std::min(chunk_begin + chunk_size, end));
+    });
+
+    Bounds3f bounds;
+    for (const Bounds3f& chunk: chunk_bounds) {
+        bounds = MergeBounds(bounds, chunk);
+    }
+    return bounds;
+}
+
+inline void ClusterBVHBuilder::BuildBinned(TaskGroup& group, uint32 node_index, uint32 begin, uint32 end) {
+    const uint32 num = end - begin;
+    if (num <= m_settings.max_leaf_size) {
+        MakeLeaf(node_index, begin, end);
+        return;
+    }
+    if (num < m_settings.linear_threshold) {
+        BuildLinear(node_index, begin, end);
+        return;
+    }
+
+    const Bounds3f centroid_bounds = ComputeCentroidBounds(begin, end);
+    const Vector3f centroid_min    = centroid_bounds.GetMin();
+    const Vector3f centroid_size   = centroid_bounds.GetDimensions();
+    const uint32   num_bins        = m_settings.num_bins;
+
+    float bin_scale[3];
+    for (uint32 axis = 0; axis < 3; axis++) {
+        const float size = GetAxis(centroid_size, axis);
+        bin_scale[axis]  = size > 0.0f ? num_bins / size : 0.0f;
+    }
+
+    auto GetBin = [&](const BuildPrim& prim, uint32 axis) {
+        const float local = (GetAxis(prim.centroid, axis) - GetAxis(centroid_min, axis)) * bin_scale[axis];
+        return std::min(static_cast<uint32>(local), num_bins - 1);
+    };
+
+    // 三个轴同时分箱，大区间分块并行后按块的顺序合并
+    auto BinRange = [&](uint32 range_begin, uint32 range_end, Bin* bins) {
+        for (uint32 i = range_begin; i < range_end; i++) {
+            const BuildPrim& prim = m_prims[i];
+            for (uint32 axis = 0; axis < 3; axis++) {
+                if (bin_scale[axis] > 0.0f) {
+                    Bin& bin = bins[axis * num_bins + GetBin(prim, axis)];
+                    bin.bounds.AddBoundingBox(prim.bounds);
+                    bin.count++;
+                }
+            }
+        }
+    };
+
+    std::vector<Bin> bins(3 * num_bins);
+    if (num < ParallelGrain) {
+        BinRange(begin, end, bins.data());
+    } else {
+        const uint32     chunk_size = ParallelGrain / 4;
+        const uint32     num_chunks = DivideAndRoundUp(num, chunk_size);
+        std::vector<Bin> chunk_bins(size_t(num_chunks) * bins.size());
+        ParallelFor("ClusterBVH.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+            const uint32 chunk_begin = begin + static_cast<uint32>(chunk) * chunk_size;
+            BinRange(chunk_begin, std::min(chunk_begin + chunk_size, end), chunk_bins.data() + chunk * bins.size());
+        });
+
+        for (uint32 chunk = 0; chunk < num_chunks; chunk++) {
+            for (size_t i = 0; i < bins.size(); i++) {
+                const Bin& chunk_bin = chunk_bins[chunk * bins.size() + i];
+                bins[i].bounds = MergeBounds(bins[i].bounds, chunk_bin.bounds);
+                bins[i].count += chunk_bin.count;
+            }
+        }
+    }
+
+    // 从两侧扫描，代价为两侧表面积乘以元素数之和
+    float  best_cost = FLT_MAX;
+    uint32 best_axis = ~0u;
+    uint32 best_bin  = 0;
+    for (uint32 axis = 0; axis < 3; axis++) {
+        if (GetAxis(centroid_size, axis) <= 0.0f) {
+            continue;
+        }
+
+        const Bin*         axis_bins = bins.data() + axis * num_bins;
+        std::vector<float> right_cost(num_bins, 0.0f);
+        Bounds3f           right_bounds;
+        uint32             right_count = 0;
+        for (uint32 i = num_bins - 1; i > 0; i--) {
+            right_bounds = MergeBounds(right_bounds, axis_bins[i].bounds);
+            right_count += axis_bins[i].count;
+            right_cost[i] = right_count ? HalfSurfaceArea(right_bounds) * right_count : 0.0f;
+        }
+
+        Bounds3f left_bounds;
+        uint32   left_count = 0;
+        for (uint32 i = 0; i + 1 < num_bins; i++) {
+            left_bounds = MergeBounds(left_bounds, axis_bins[i].bounds);
+            left_count += axis_bins[i].count;
+            if (left_count == 0 || left_count == num) {
+                continue;
+            }
+
+            const float cost = HalfSurfaceArea(left_bounds) * left_count + right_cost[i + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin  = i;
+            }
+        }
+    }
+
+    uint32 mid;
+    if (best_axis != ~0u) {
+        mid = static_cast<uint32>(
+            std::partition(
+                m_prims.begin() + begin,
+                m_prims.begin() + end,
+                [&](const BuildPrim& prim) { return GetBin(prim, best_axis) <= best_bin; }
+            ) -
+            m_prims.begin()
+        );
+    } else {
+        // 所有中心重合，无法按空间划分，直接对半分
+        mid = begin + num / 2;
+    }
+    CHECK(begin < mid && mid < end);
+
+    const uint32 children = AllocateNodes(2);
+
+    BinaryNode& node = m_nodes[node_index];
+    node.begin       = begin;
+    node.end         = end;
+    node.children[0] = children;
+    node.children[1] = children + 1;
+
+    // 较大的一侧作为新任务，另一侧在当前线程继续
+    if (mid - begin >= TaskGrain) {
+        group.Run([this, &group, children, begin, mid] { BuildBinned(group, children, begin, mid); });
+    } else {
+        BuildBinned(group, children, begin, mid);
+    }
+    BuildBinned(group, children + 1, mid, end);
+}
+
+inline void ClusterBVHBuilder::BuildLinear(uint32 node_index, uint32 begin, uint32 end) {
+    const Bounds3f centroid_bounds = ComputeCentroidBounds(begin, end);
+
+    // 按(莫顿码, 原始索引)排序，保证结果确定
+    std::vector<std::pair<uint32, uint32>> keys(end - begin);
+    for (uint32 i = begin; i < end; i++) {
+        keys[i - begin] = { MortonKey3(m_prims[i].centroid, centroid_bounds), i };
+    }
+    std::sort(keys.begin(), keys.end(), [this](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first < b.first : m_prims[a.second].index < m_prims[b.second].index;
+    });
+
+    std::vector<uint32>    codes(keys.size());
+    std::vector<BuildPrim> sorted(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        codes[i]  = keys[i].first;
+        sorted[i] = m_prims[keys[i].second];
+    }
+    std::copy(sorted.begin(), sorted.end(), m_prims.begin() + begin);
+
+    BuildLinearNode(node_index, begin, end, codes, begin);
+}
+
+// 在莫顿码最高的不同位处划分，codes[i - base]对应m_prims[i]
+inline void ClusterBVHBuilder::BuildLinearNode(
+    uint32                     node_index,
+    uint32                     begin,
+    uint32                     end,
+    const std::vector<uint32>& codes,
+    uint32                     base
+) {
+    if (end - begin <= m_settings.max_leaf_size) {
+        MakeLeaf(node_index, begin, end);
+        return;
+    }
+
+    const uint32 first_code = codes[begin - base];
+    const uint32 last_code  = codes[end - 1 - base];
+
+    uint32 mid;
+    if (first_code == last_code) {
+        mid = begin + (end - begin) / 2;
+    } else {
+        // 已排序，最高的不同位为0的元素都在前面
+        const uint32 split_bit = 1u << (31 - std::countl_zero(first_code ^ last_code));
+        mid                    = static_cast<uint32>(
+            std::partition_point(
+                codes.begin() + (begin - base),
+                codes.begin() + (end - base),
+                [split_bit](uint32 code) { return (code & split_bit) == 0; }
+            ) -
+            codes.begin()
+        ) + base;
+    }
+
+    const uint32 children = AllocateNodes(2);
+
+    BinaryNode& node = m_nodes[node_index];
+    node.begin       = begin;
+    node.end         = end;
+    node.children[0] = children;
+    node.children[1] = children + 1;
+
+    BuildLinearNode(children, begin, mid, codes, base);
+    BuildLinearNode(children + 1, mid, end, codes, base);
+}
+
+inline void ClusterBVHBuilder::Refit() {
+    for (uint32 node_index = static_cast<uint32>(m_nodes.size()); node_index-- > 0;) {
+        BinaryNode& node = m_nodes[node_index];
+        if (node.children[0] == ~0u) {
+            node.bounds = Bounds3f();
+            node.sphere = m_spheres[m_prims[node.begin].index];
+            for (uint32 i = node.begin; i < node.end; i++) {
+                node.bounds.AddBoundingBox(m_prims[i].bounds);
+                node.sphere = MergeSpheres(node.sphere, m_spheres[m_prims[i].index]);
+            }
+        } else {
+            const BinaryNode& left  = m_nodes[node.children[0]];
+            const BinaryNode& right = m_nodes[node.children[1]];
+            node.bounds             = MergeBounds(left.bounds, right.bounds);
+            node.sphere             = MergeSpheres(left.sphere, right.sphere);
+        }
+    }
+}
+
+// 广度优先地合并二叉树：每次展开表面积最大的内部子节点，直到凑满8个子节点
+inline void ClusterBVHBuilder::Collapse(ClusterBVH& bvh) const {
+    std::vector<uint32> queue = { 0 };
+    for (size_t queue_index = 0; queue_index < queue.size(); queue_index++) {
+        uint32 lanes[ClusterBVH8Node::Width];
+        uint32 num_lanes = 0;
+
+        const BinaryNode& root = m_nodes[queue[queue_index]];
+        if (root.children[0] == ~0u) {
+            lanes[num_lanes++] = queue[queue_index];
+        } else {
+            lanes[num_lanes++] = root.children[0];
+            lanes[num_lanes++] = root.children[1];
+        }
+
+        while (num_lanes < ClusterBVH8Node::Width) {
+            int32 best_lane = -1;
+            float best_area = -1.0f;
+            for (uint32 i = 0; i < num_lanes; i++) {
+                const BinaryNode& lane = m_nodes[lanes[i]];
+                if (lane.children[0] != ~0u && HalfSurfaceArea(lane.bounds) > best_area) {
+                    best_area = HalfSurfaceArea(lane.bounds);
+                    best_lane = static_cast<int32>(i);
+                }
+            }
+            if (best_lane < 0) {
+                break;
+            }
+
+            const BinaryNode& expanded = m_nodes[lanes[best_lane]];
+            lanes[best_lane]           = expanded.children[0];
+            lanes[num_lanes++]         = expanded.children[1];
+        }
+
+        ClusterBVH8Node node;
+        for (uint32 i = 0; i < ClusterBVH8Node::Width; i++) {
+            node.min_x[i] = node.min_y[i] = node.min_z[i] = FLT_MAX;
+            node.max_x[i] = node.max_y[i] = node.max_z[i] = -FLT_MAX;
+            node.sphere_x[i] = node.sphere_y[i] = node.sphere_z[i] = node.sphere_radius[i] = 0.0f;
+            node.child[i]                                                                  = ~0u;
+            node.num_clusters[i]                                                           = 0;
+        }
+
+        for (uint32 i = 0; i < num_lanes; i++) {
+            const BinaryNode& lane     = m_nodes[lanes[i]];
+            const Vector3f    lane_min = lane.bounds.GetMin();
+            const Vector3f    lane_max = lane.bounds.GetMax();
+
+            node.min_x[i]         = lane_min.x;
+            node.min_y[i]         = lane_min.y;
+            node.min_z[i]         = lane_min.z;
+            node.max_x[i]         = lane_max.x;
+            node.max_y[i]         = lane_max.y;
+            node.max_z[i]         = lane_max.z;
+            node.sphere_x[i]      = lane.sphere.center.x;
+            node.sphere_y[i]      = lane.sphere.center.y;
+            node.sphere_z[i]      = lane.sphere.center.z;
+            node.sphere_radius[i] = lane.sphere.radius;
+
+            if (lane.children[0] == ~0u) {
+                node.child[i]        = lane.begin;
+                node.num_clusters[i] = static_cast<uint8>(lane.end - lane.begin);
+            } else {
+                // 子节点按入队顺序编号
+                node.child[i] = static_cast<uint32>(queue.size());
+                queue.push_back(lanes[i]);
+            }
+        }
+
+        bvh.nodes.push_back(node);
+    }
+}
+
+inline ClusterBVH BuildClusterBVH(
+    std::span<const Bounds3f>      bounds,
+    std::span<const ClusterSphere> spheres,
+    const ClusterBVHSettings&      settings = {}
+) {
+    ClusterBVHBuilder builder(bounds, spheres, settings);
+    return builder.Build();
+}
+
+inline ClusterBVH BuildClusterBVH(
+    const Cluster*            clusters,
+    size_t                    num_clusters,
+    const ClusterBVHSettings& settings = {}
+) {
+    std::vector<Bounds3f>      bounds(num_clusters);
+    std::vector<ClusterSphere> spheres(num_clusters);
+    ParallelFor("BuildClusterBVH.ParallelFor", num_clusters, 256, [&](size_t index) {
+        bounds[index]  = clusters[index].Bounds;
+        spheres[index] = ComputeClusterSphere(clusters[index]);
+    });
+    return BuildClusterBVH(bounds, spheres, settings);
+}
@@ -0,0 +1,500 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "Parallel.hpp"
+#include "EdgeHash.hpp"
+#include "EdgeSort.hpp"
+#include "VectorMath.hpp"
+#include "Adjacency.hpp"
+#include "DisjointSet.hpp"
+#include "GraphPartitioner.hpp"
+#include "BuildStats.hpp"
+#include "StridedView.hpp"
+#include "VertexCacheOptimizer.hpp"
+#include "ClusterMaterials.hpp"
+
+#include <span>
+
+struct ClusterBuildSettings {
+    int32 min_partition_size = Cluster::ClusterSize - 4;
+    int32 max_partition_size = Cluster::ClusterSize;
+
+    // 三角形数量达到该值时启用多线程划分
+    uint32 multi_threaded_threshold = 5000;
+
+    // 并行阶段的结果按固定顺序合并，任意线程数下划分结果逐位一致。
+    // 关闭后分区集合不变，但cluster的顺序取决于线程调度
+    bool deterministic = true;
+
+    // 边匹配的方式，结果相同。Sort的内存访问是顺序的，适合大网格；Hash的内存占用更小
+    EdgeMatchEngine edge_engine = EdgeMatchEngine::Hash;
+
+    // 小岛寻找其他岛上邻近三角形的方式。Grid找到的是真正的最近邻，能减少零散的cluster，需要额外在质心上建立网格
+    LocalityLinkSearch locality_search = LocalityLinkSearch::MortonWindow;
+    // Grid方式下局部连接的最大距离，0表示不限制
+    float locality_radius = 0.0f;
+
+    // 不同材质的三角形之间共享边在图中的权重，普通共享边为4 * 65。较小的值使划分倾向于沿材质接缝切开，0表示不区分
+    int32 material_seam_cost = 0;
+    // 每个cluster最多包含的材质数，0表示不限制。划分后把超出的cluster按材质拆开
+    uint32 max_cluster_materials = 0;
+
+    // 每个cluster最多包含的不同顶点数，0表示不限制。超出时继续二分，保证mesh shader的meshlet不会溢出
+    uint32 max_cluster_vertices = 0;
+
+    // 提取cluster后按顶点缓存优化每个cluster内的三角形顺序
+    bool optimize_vertex_cache = false;
+
+    // 主要数据结构的内存预算（字节），0表示不限制。预估超出预算时改用紧凑的邻接表并按精确大小构建图，结果不变
+    uint64 memory_budget = 0;
+
+    // 导出mesh shader meshlet的设置，同时限制三角形数和顶点数
+    static ClusterBuildSettings Meshlet(uint32 max_vertices = 64, int32 max_triangles = 124);
+
+    // 材质分别为material0和material1的两个三角形之间共享边在图中的权重
+    idx_t GetEdgeCost(int32 material0, int32 material1) const {
+        return material_seam_cost && material0 != material1 ? material_seam_cost : 4 * 65;
+    }
+};
+
+inline ClusterBuildSettings ClusterBuildSettings::Meshlet(uint32 max_vertices, int32 max_triangles) {
+    // 二分得到的两侧都至少有两个三角形，顶点数上限太小时无法满足
+    CHECK(max_vertices >= 9);
+    CHECK(max_triangles > 4 && max_triangles <= Cluster::ClusterSize);
+
+    ClusterBuildSettings settings;
+    settings.min_partition_size   = max_triangles - 4;
+    settings.max_partition_size   = max_triangles;
+    settings.max_cluster_vertices = max_vertices;
+    return settings;
+}
+
+// ClusterTriangles的最终划分结果，ranges中的每个区间对应indices中属于同一个cluster的三角形
+struct ClusterPartition {
+    std::vector<GraphPartitioner::Range> ranges;
+    std::vector<uint32>                  indices;
+
+    // 划分结果的64位指纹，用于比较不同线程数或不同机器上的构建结果
+    uint64 GetFingerprint() const;
+};
+
+inline uint64 ClusterPartition::GetFingerprint() const {
+    Hash128 hash = Murmur128(ranges.data(), ranges.size() * sizeof(GraphPartitioner::Range));
+    hash         = Murmur128(indices.data(), indices.size() * sizeof(uint32), hash);
+    return hash.low ^ hash.high;
+}
+
+// 以prefix为前缀记录哈希表的统计。链长直方图的每一项为一个计数，负载因子为Entries除以Buckets
+inline void AddHashTableCounters(BuildStats& stats, const std::string& prefix, const HashTableStats& table_stats) {
+    stats.AddCounter(prefix + ".Buckets", table_stats.hash_size);
+    stats.AddCounter(prefix + ".Entries", table_stats.num_entries);
+    stats.MaxCounter(prefix + ".MaxChain", table_stats.max_chain);
+    for (uint32 chain = 0; chain <= HashTableStats::MaxHistogramChain; chain++) {
+        stats.AddCounter(prefix + ".Chain." + std::to_string(chain), table_stats.chain_histogram[chain]);
+    }
+    stats.AddCounter(prefix + ".Queries", table_stats.num_queries);
+    stats.AddCounter(prefix + ".Probes", table_stats.num_probes);
+    stats.AddCounter(prefix + ".Matches", table_stats.num_matches);
+    stats.MaxCounter(prefix + ".MaxProbes", table_stats.max_probes);
+}
+
+// ClusterTriangles支持的索引类型
+template<typename IndexType>
+concept ClusterIndexType = std::same_as<IndexType, uint16> || std::same_as<IndexType, uint32>;
+
+// EdgeIndexType为边哈希表和邻接表中存储边索引的类型，边数必须能用它表示
+template<ClusterIndexType EdgeIndexType, ClusterIndexType IndexType>
+inline void ClusterTrianglesImpl(
+    ConstStridedView<Vector3f>  positions,
+    std::span<const IndexType>  indices,
+    std::span<const int32>      material_indexes,
+    std::vector<Cluster>&       clusters,
+    const Bounds3f&             mesh_bounds,
+    const ClusterBuildSettings& settings,
+    ClusterPartition*           out_partition,
+    BuildStats*                 stats
+) {
+    uint32 num_triangles = static_cast<uint32>(indices.size() / 3);
+
+    const bool sort_edges = settings.edge_engine == EdgeMatchEngine::Sort;
+
+    BasicAdjacency<EdgeIndexType>      adjacency { indices.size() };
+    BasicStaticEdgeHash<EdgeIndexType> edge_hash;
+
+    // 复杂边的所有匹配，按(边, 匹配边)排序
+    std::vector<std::pair<int32, int32>> complex_links;
+
+    auto GetPosition = [positions, indices](uint32 edge_index) {
+        return positions[static_cast<int32>(indices[edge_index])];
+    };
+
+    if (sort_edges) {
+        BuildStageScope stage(stats, "EdgeSort");
+
+        MatchEdgesSorted(static_cast<uint32>(indices.size()), GetPosition, adjacency, complex_links);
+
+        stage.Track(adjacency.GetAllocatedSize() + indices.size() * 2 * (sizeof(uint64) + sizeof(uint32)));
+    } else {
+        {
+            BuildStageScope stage(stats, "EdgeHash");
+
+            // 将每个索引视作一条边，一次性构建只读的边哈希表
+            edge_hash.Build(static_cast<uint32>(indices.size()), GetPosition);
+
+            stage.Track(edge_hash.GetAllocatedSize() + adjacency.GetAllocatedSize());
+        }
+
+        {
+            BuildStageScope stage(stats, "Adjacency");
+
+            // 将每个索引视作一条边，确定边的邻接关系。按固定大小分块并行，复杂边的所有匹配收集到所在块的数组中
+            constexpr uint32 ChunkSize  = 1024;
+            const uint32     num_edges  = static_cast<uint32>(indices.size());
+            const uint32     num_chunks = DivideAndRoundUp(num_edges, ChunkSize);
+
+            std::vector<std::vector<std::pair<int32, int32>>> chunk_links(num_chunks);
+            ParallelFor("ClusterTriangles.ParalleFor", num_chunks, 1, [&](size_t chunk) {
+                std::vector<std::pair<int32, int32>>& links = chunk_links[chunk];
+
+                const uint32 chunk_begin = static_cast<uint32>(chunk) * ChunkSize;
+                const uint32 chunk_end   = std::min(chunk_begin + ChunkSize, num_edges);
+                for (uint32 edge_index = chunk_begin; edge_index < chunk_end; edge_index++) {
+                    // 遍历边的邻接边，先全部记录下来
+                    const size_t first = links.size();
+                    edge_hash.ForAllMatching(edge_index, GetPosition, [&](int32 edge_index0, int32 edge_index1) {
+                        links.emplace_back(edge_index0, edge_index1);
+                    });
+
+                    // 通常共边三角形的那条共边是一对方向相反的边互相邻接，超过1条邻接边说明是个复杂连接
+                    const size_t adj_count = links.size() - first;
+                    const int32  adj_index = adj_count == 1 ? links.back().second : adj_count > 1 ? -2 : -1;
+                    // 桶内的边按索引升序排列，复杂边的匹配已经有序
+                    if (adj_count <= 1) {
+                        links.resize(first);
+                    }
+
+                    adjacency.SetDirect(edge_index, adj_index); // 记录直接邻边
+                }
+            });
+
+            // 块内按边的顺序收集，按块的顺序拼接后整体有序
+            for (const auto& links: chunk_links) {
+                complex_links.insert(complex_links.end(), links.begin(), links.end());
+            }
+
+#if HASH_TABLE_STATS
+            if (stats) {
+                AddHashTableCounters(*stats, "EdgeHash", edge_hash.GetStats());
+            }
+#endif
+
+            // 边哈希表只用于建立邻接关系
+            edge_hash.Free();
+
+            stage.Track(adjacency.GetAllocatedSize() + complex_links.capacity() * sizeof(complex_links[0]));
+        }
+    }
+
+    // 三角形数量足够多时启用多线程
+    const bool enable_multi_threaded = num_triangles >= settings.multi_threaded_threshold;
+
+    DisjointSet disjoint_set(num_triangles);
+
+    {
+        BuildStageScope stage(stats, "DisjointSet");
+
+        // 先一次性建立所有复杂边的邻接关系，再合并邻边三角形
+        adjacency.LinkSorted(complex_links);
+        complex_links.clear();
+        complex_links.shrink_to_fit();
+
+        if (enable_multi_threaded) {
+            // 并发合并的根节点同样是连通结构中最大的索引，与串行合并的结果一致
+            ParallelFor("ClusterTriangles.ParalleFor", indices.size(), 4096, [&](uint32 edge_index) {
+                adjacency.ForAll(edge_index, [&](int32 edge_index0, int32 edge_index1) {
+                    if (edge_index0 > edge_index1) {
+                        disjoint_set.UnionConcurrent(edge_index0 / 3, edge_index1 / 3);
+                    }
+                });
+            });
+        } else {
+            // 遍历所有边，最终得到若干个互不连通的拓扑结构
+            for (uint32 edge_index = 0, num = static_cast<uint32>(indices.size()); edge_index < num; edge_index++) {
+                // 遍历当前边的邻接边
+                adjacency.ForAll(edge_index, [&](int32 edge_index0, int32 edge_index1) {
+                    // 合并邻边三角形
+                    if (edge_index0 > edge_index1) {
+                        // 随着连续合并操作，三角形间形成一条路径链，最大索引的三角形自然成为整个连通结构的终点
+                        disjoint_set.UnionSequential(edge_index0 / 3, edge_index1 / 3);
+                    }
+                });
+            }
+        }
+
+        stage.Track(adjacency.GetAllocatedSize() + disjoint_set.GetAllocatedSize());
+    }
+
+    // 预估构建图时的内存：邻接表、并查集、划分器中每个三角形的索引和排序数据，以及图的邻接数组
+    const uint64 estimated_peak = adjacency.GetAllocatedSize() + disjoint_set.GetAllocatedSize() +
+                                  uint64(num_triangles) * (4 * sizeof(uint32) + sizeof(GraphPartitioner::Range)) +
+                                  uint64(indices.size() + adjacency.extended_compact.size()) * 2 * sizeof(idx_t);
+    const bool low_memory = settings.memory_budget != 0 && estimated_peak > settings.memory_budget;
+
+    if (low_memory) {
+        adjacency.Compact();
+    }
+
+    int32 min_partition_size = settings.min_partition_size;
+    int32 max_partition_size = settings.max_partition_size;
+    if (settings.max_cluster_vertices) {
+        CHECK(settings.max_cluster_vertices >= 9);
+
+        // 流形网格上n*n个四边形的紧凑分区有2n^2个三角形和(n+1)^2个顶点。顶点上限明显小于三角形上限时，
+        // 按顶点上限反推并留出边界不规则的余量，避免大部分分区都因顶点超限而被对半拆开
+        const float side          = std::sqrt(static_cast<float>(settings.max_cluster_vertices)) - 1.5f;
+        const int32 expected_size = std::max(4, static_cast<int32>(2.0f * side * side));
+        if (expected_size < max_partition_size) {
+            min_partition_size = std::max(2, min_partition_size - (max_partition_size - expected_size));
+            max_partition_size = expected_size;
+        }
+    }
+
+    // 初始化图划分器
+    GraphPartitioner partitioner(num_triangles, min_partition_size, max_partition_size);
+    partitioner.deterministic   = settings.deterministic;
+    partitioner.locality_search = settings.locality_search;
+    partitioner.locality_radius = settings.locality_radius;
+    if (settings.max_cluster_vertices) {
+
+        // 统计分区内不同顶点的数量，和Cluster提取时的顶点去重方式一致
+        partitioner.partition_fits = [indices, max_vertices = settings.max_cluster_vertices](
+                                         const uint32* elements,
+                                         uint32        num
+                                     ) {
+            if (num * 3 <= max_vertices) {
+                return true;
+            }
+
+            thread_local std::vector<uint32> verts;
+            verts.clear();
+            for (uint32 i = 0; i < num; i++) {
+                for (uint32 k = 0; k < 3; k++) {
+                    verts.push_back(indices[elements[i] * 3 + k]);
+                }
+            }
+            std::sort(verts.begin(), verts.end());
+            return static_cast<uint32>(std::unique(verts.begin(), verts.end()) - verts.begin()) <= max_vertices;
+        };
+    }
+    {
+        // 获取三角形的中心坐标
+        auto GetCenter = [&GetPosition](uint32 tri_index) {
+            Point3f center;
+            center = GetPosition(tri_index * 3 + 0);
+            center += GetPosition(tri_index * 3 + 1);
+            center += GetPosition(tri_index * 3 + 2);
+            return center * (1.0f / 3.0f);
+        };
+
+        {
+            BuildStageScope stage(stats, "LocalityLinks");
+
+            // 建立邻接关系
+            partitioner.BuildLocalityLinks(disjoint_set, mesh_bounds, material_indexes, GetCenter);
+
+            // 并查集只用于区分局部连接的岛
+            disjoint_set.Free();
+
+            if (stats) {
+                stats->AddCounter("LocalityLinks.Count", partitioner.locality_links.size());
+            }
+
+            stage.Track(adjacency.GetAllocatedSize() + partitioner.GetAllocatedSize());
+        }
+
+        GraphPartitioner::GraphData* graph = nullptr;
+        {
+            BuildStageScope stage(stats, "Graph");
+
+            // 低内存模式下先统计邻接边的精确数量，避免邻接数组扩容时新旧两份数组同时存在
+            uint32 num_adjacency = num_triangles * 3;
+            if (low_memory) {
+                num_adjacency = 0;
+                for (uint32 edge_index = 0, num = static_cast<uint32>(indices.size()); edge_index < num; edge_index++) {
+                    adjacency.ForAll(edge_index, [&num_adjacency](int32, int32) { num_adjacency++; });
+                }
+            }
+
+            graph = partitioner.NewGraph(num_adjacency);
+
+            // 跨材质接缝的共享边使用单独的权重
+            auto GetEdgeCost = [&](uint32 tri_index, uint32 adj_tri_index) {
+                if (material_indexes.empty()) {
+                    return settings.GetEdgeCost(0, 0);
+                }
+                return settings.GetEdgeCost(material_indexes[tri_index], material_indexes[adj_tri_index]);
+            };
+
+            // 遍历每个三角形
+            for (uint32 i = 0; i < num_triangles; i++) {
+                graph->adjacency_offset[i] = graph->adjacency.size(); // 设置邻接表偏移量
+                uint32 tri_index           = partitioner.indices[i]; // 获取三角形索引
+                // 遍历三角形的三个边
+                for (int k = 0; k < 3; k++) {
+                    // 遍历边的所有邻接边
+                    adjacency.ForAll(tri_index * 3 + k, [&](int32 edge_index, int32 adj_index) {
+                        // 将邻接边所在的三角形索引添加到邻接三角形
+                        const uint32 adj_tri_index = adj_index / 3;
+                        partitioner.AddAdjaceny(graph, adj_tri_index, GetEdgeCost(tri_index, adj_tri_index));
+                    });
+                }
+
+                // 将该三角形索引添加
+                partitioner.AddLocalityLinks(graph, tri_index, 1);
+            }
+
+            // 邻接表和局部连接都已写入图中
+            adjacency.Free();
+            partitioner.locality_links.clear();
+            partitioner.locality_links.shrink_to_fit();
+
+            stage.Track(graph->GetAllocatedSize() + partitioner.GetAllocatedSize());
+        }
+
+        // 设置最后一个三角形的邻接偏移量
+        if (num_triangles <= 0) {
+            delete graph;
+            return;
+        }
+        graph->adjacency_offset[num_triangles] = graph->adjacency.size();
+
+        {
+            BuildStageScope stage(stats, "Partition");
+            stage.Track(graph->GetAllocatedSize() + partitioner.GetAllocatedSize());
+
+            partitioner.ParititionStrict(graph, enable_multi_threaded);
+
+            if (settings.max_cluster_materials) {
+                const uint32 num_split = SplitPartitionsByMaterial(
+                    partitioner.ranges,
+                    partitioner.indices,
+                    material_indexes,
+                    settings.max_cluster_materials
+                );
+                if (stats) {
+                    stats->AddCounter("Partition.MaterialSplits", num_split);
+                }
+            }
+
+            CHECK(partitioner.ranges.size());
+        }
+    }
+
+    // 根据划分结果提取cluster
+    const size_t base_cluster = clusters.size();
+    {
+        BuildStageScope stage(stats, "Clusters");
+
+        clusters.resize(base_cluster + partitioner.ranges.size());
+
+        ParallelFor("ClusterTriangles.ParalleFor", partitioner.ranges.size(), 1024, [&](uint32 index) {
+            const auto& range = partitioner.ranges[index];
+
+            clusters[base_cluster + index] =
+                Cluster(positions, indices, material_indexes, range.begin, range.end, partitioner.indices);
+            clusters[base_cluster + index].Bound();
+
+            const uint32 num_verts = clusters[base_cluster + index].NumVerts;
+            CHECK(!settings.max_cluster_vertices || num_verts <= settings.max_cluster_vertices);
+        });
+
+        if (stats) {
+            ClusterMaterialReport report =
+                ComputeClusterMaterialReport(clusters.data() + base_cluster, clusters.size() - base_cluster);
+            stats->AddCounter("Clusters.Count", report.num_clusters);
+            stats->AddCounter("Clusters.Materials", report.num_materials);
+            stats->AddCounter("Clusters.MultiMaterial", report.num_multi_material);
+        }
+
+        stage.Track(partitioner.GetAllocatedSize() + clusters.capacity() * sizeof(Cluster));
+    }
+
+    if (settings.optimize_vertex_cache) {
+        BuildStageScope stage(stats, "VertexCache");
+
+        VertexCacheReport report =
+            OptimizeClusterVertexCache(clusters.data() + base_cluster, clusters.size() - base_cluster);
+        if (stats) {
+            stats->AddCounter("VertexCache.Tris", report.num_tris);
+            stats->AddCounter("VertexCache.MissesBefore", report.misses_before);
+            stats->AddCounter("VertexCache.MissesAfter", report.misses_after);
+        }
+    }
+
+    if (out_partition) {
+        out_partition->ranges  = std::move(partitioner.ranges);
+        out_partition->indices = std::move(partitioner.indices);
+    }
+}
+
+// 直接在调用方的顶点缓冲（可以是交错的顶点格式）和16位或32位索引上构建cluster，不拷贝输入数据。
+// 每个数据结构在最后一次使用后立即释放，stats不为空时记录每个阶段的耗时和内存。
+// 边数小于65534的小网格使用16位的边哈希表和邻接表，减半这两个阶段的内存访问量
+template<ClusterIndexType IndexType>
+inline void ClusterTriangles(
+    ConstStridedView<Vector3f>  positions,
+    std::span<const IndexType>  indices,
+    std::span<const int32>      material_indexes,
+    std::vector<Cluster>&       clusters,
+    const Bounds3f&             mesh_bounds,
+    const ClusterBuildSettings& settings      = {},
+    ClusterPartition*           out_partition = nullptr,
+    BuildStats*                 stats         = nullptr
+) {
+    if (indices.size() <= Adjacency16::MaxNum) {
+        ClusterTrianglesImpl<uint16>(
+            positions,
+            indices,
+            material_indexes,
+            clusters,
+            mesh_bounds,
+            settings,
+            out_partition,
+            stats
+        );
+    } else {
+        ClusterTrianglesImpl<uint32>(
+            positions,
+            indices,
+            material_indexes,
+            clusters,
+            mesh_bounds,
+            settings,
+            out_partition,
+            stats
+        );
+    }
+}
+
+inline void ClusterTriangles(
+    const MeshBuildVertexView&  verts,
+    const std::vector<uint32>&  indices,
+    const std::vector<int32>&   material_indexes,
+    std::vector<Cluster>&       clusters,
+    const Bounds3f&             mesh_bounds,
+    const ClusterBuildSettings& settings      = {},
+    ClusterPartition*           out_partition = nullptr,
+    BuildStats*                 stats         = nullptr
+) {
+    ClusterTriangles(
+        MakeConstStridedView(verts.Positions),
+        std::span<const uint32>(indices),
+        std::span<const int32>(material_indexes),
+        clusters,
+        mesh_bounds,
+        settings,
+        out_partition,
+        stats
+    );
+}
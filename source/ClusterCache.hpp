@@ -0,0 +1,407 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "ClusterBuilder.hpp"
+#include "MappedFile.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <span>
+
+// 序列化后的cluster数据布局：
+// ClusterBlobHeader | ClusterBlobEntry[num_clusters] | Range[num_ranges] | uint32[num_indices]
+// | float[num_vert_floats] | uint32[num_cluster_indexes] | int32[num_cluster_tris]
+struct ClusterBlobHeader {
+    static const uint32 Magic   = 0x434c434e; // "NCLC"
+    static const uint32 Version = 1;
+
+    uint32  magic;
+    uint32  version;
+    Hash128 key;
+
+    uint32 num_clusters;
+    uint32 num_ranges;
+    uint32 num_indices;
+    uint32 num_vert_floats;
+    uint32 num_cluster_indexes;
+    uint32 num_cluster_tris;
+};
+
+struct ClusterBlobEntry {
+    uint32 num_verts;
+    uint32 num_tris;
+    uint32 verts_offset; // 在float数组中的偏移
+    uint32 indexes_offset; // 在cluster索引数组中的偏移
+    uint32 tris_offset; // 在材质数组中的偏移
+    int32  mip_level;
+    uint64 guid;
+    float  bounds_min[3];
+    float  bounds_max[3];
+};
+
+static_assert(std::is_trivially_copyable_v<ClusterBlobEntry>);
+static_assert(std::is_trivially_copyable_v<GraphPartitioner::Range>);
+
+// 将cluster数组和划分结果写入输出流
+inline void WriteClusterBlob(
+    std::ostream&           out,
+    const Hash128&          key,
+    const Cluster*          clusters,
+    size_t                  num_clusters,
+    const ClusterPartition& partition
+) {
+    ClusterBlobHeader header {};
+    header.magic        = ClusterBlobHeader::Magic;
+    header.version      = ClusterBlobHeader::Version;
+    header.key          = key;
+    header.num_clusters = static_cast<uint32>(num_clusters);
+    header.num_ranges   = static_cast<uint32>(partition.ranges.size());
+    header.num_indices  = static_cast<uint32>(partition.indices.size());
+
+    std::vector<ClusterBlobEntry> entries(num_clusters);
+    for (size_t i = 0; i < num_clusters; i++) {
+        const Cluster&    cluster = clusters[i];
+        ClusterBlobEntry& entry   = entries[i];
+
+        entry.num_verts      = cluster.NumVerts;
+        entry.num_tris       = cluster.NumTris;
+        entry.verts_offset   = header.num_vert_floats;
+        entry.indexes_offset = header.num_cluster_indexes;
+        entry.tris_offset    = header.num_cluster_tris;
+        entry.mip_level      = cluster.MipLevel;
+        entry.guid           = cluster.GUID;
+
+        Vector3f bounds_min = cluster.Bounds.GetMin();
+        Vector3f bounds_max = cluster.Bounds.GetMax();
+        std::memcpy(entry.bounds_min, &bounds_min, sizeof(entry.bounds_min));
+        std::memcpy(entry.bounds_max, &bounds_max, sizeof(entry.bounds_max));
+
+        header.num_vert_floats += static_cast<uint32>(cluster.Verts.size());
+        header.num_cluster_indexes += static_cast<uint32>(cluster.Indexes.size());
+        header.num_cluster_tris += static_cast<uint32>(cluster.MaterialIndexes.size());
+    }
+
+    auto Write = [&out](const void* data, size_t size) {
+        if (size) out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+
+    Write(&header, sizeof(header));
+    Write(entries.data(), entries.size() * sizeof(ClusterBlobEntry));
+    Write(partition.ranges.data(), partition.ranges.size() * sizeof(GraphPartitioner::Range));
+    Write(partition.indices.data(), partition.indices.size() * sizeof(uint32));
+    for (size_t i = 0; i < num_clusters; i++) {
+        Write(clusters[i].Verts.data(), clusters[i].Verts.size() * sizeof(float));
+    }
+    for (size_t i = 0; i < num_clusters; i++) {
+        Write(clusters[i].Indexes.data(), clusters[i].Indexes.size() * sizeof(uint32));
+    }
+    for (size_t i = 0; i < num_clusters; i++) {
+        Write(clusters[i].MaterialIndexes.data(), clusters[i].MaterialIndexes.size() * sizeof(int32));
+    }
+}
+
+// 直接指向序列化数据的只读视图，不拷贝任何数据。
+// 文件头和各数组都按自身类型对齐，内存映射的起始地址按页对齐，所以可以直接按类型访问
+class ClusterBlobView {
+public:
+    // 校验数据并建立视图，数据不完整或key不匹配时返回false
+    bool Parse(const uint8* data, size_t size, const Hash128& key);
+
+    uint32 NumClusters() const { return m_header.num_clusters; }
+
+    std::span<const ClusterBlobEntry>        Entries() const { return m_entries; }
+    std::span<const GraphPartitioner::Range> Ranges() const { return m_ranges; }
+    std::span<const uint32>                  Indices() const { return m_indices; }
+
+    std::span<const float> GetVerts(const ClusterBlobEntry& entry) const {
+        return m_verts.subspan(entry.verts_offset, entry.num_verts * Cluster::GetVertSize());
+    }
+    std::span<const uint32> GetIndexes(const ClusterBlobEntry& entry) const {
+        return m_indexes.subspan(entry.indexes_offset, entry.num_tris * 3);
+    }
+    std::span<const int32> GetMaterialIndexes(const ClusterBlobEntry& entry) const {
+        return m_materials.subspan(entry.tris_offset, entry.num_tris);
+    }
+
+    // 拷贝出拥有自己数据的Cluster并追加到clusters末尾
+    void CopyClusters(std::vector<Cluster>& clusters) const;
+
+private:
+    ClusterBlobHeader m_header {};
+
+    std::span<const ClusterBlobEntry>        m_entries;
+    std::span<const GraphPartitioner::Range> m_ranges;
+    std::span<const uint32>                  m_indices;
+    std::span<const float>                   m_verts;
+    std::span<const uint32>                  m_indexes;
+    std::span<const int32>                   m_materials;
+};
+
+static_assert(sizeof(ClusterBlobHeader) % alignof(ClusterBlobEntry) == 0);
+static_assert(sizeof(ClusterBlobEntry) % alignof(GraphPartitioner::Range) == 0);
+
+inline bool ClusterBlobView::Parse(const uint8* data, size_t size, const Hash128& key) {
+    if (size < sizeof(ClusterBlobHeader) || reinterpret_cast<uintptr_t>(data) % alignof(ClusterBlobEntry) != 0) {
+        return false;
+    }
+
+    std::memcpy(&m_header, data, sizeof(m_header));
+    if (m_header.magic != ClusterBlobHeader::Magic || m_header.version != ClusterBlobHeader::Version ||
+        m_header.key != key) {
+        return false;
+    }
+
+    const size_t expected_size = sizeof(ClusterBlobHeader) +
+                                 size_t(m_header.num_clusters) * sizeof(ClusterBlobEntry) +
+                                 size_t(m_header.num_ranges) * sizeof(GraphPartitioner::Range) +
+                                 size_t(m_header.num_indices) * sizeof(uint32) +
+                                 size_t(m_header.num_vert_floats) * sizeof(float) +
+                                 size_t(m_header.num_cluster_indexes) * sizeof(uint32) +
+                                 size_t(m_header.num_cluster_tris) * sizeof(int32);
+    if (size != expected_size) {
+        return false;
+    }
+
+    const uint8* cursor = data + sizeof(ClusterBlobHeader);
+    auto         Advance = [&cursor]<typename T>(std::span<const T>& view, uint32 num) {
+        view = std::span<const T>(reinterpret_cast<const T*>(cursor), num);
+        cursor += num * sizeof(T);
+    };
+
+    Advance(m_entries, m_header.num_clusters);
+    Advance(m_ranges, m_header.num_ranges);
+    Advance(m_indices, m_header.num_indices);
+    Advance(m_verts, m_header.num_vert_floats);
+    Advance(m_indexes, m_header.num_cluster_indexes);
+    Advance(m_materials, m_header.num_cluster_tris);
+
+    // 校验每个cluster的数据范围，避免损坏的文件导致越界访问
+    for (const ClusterBlobEntry& entry: m_entries) {
+        const uint64 verts_end   = uint64(entry.verts_offset) + uint64(entry.num_verts) * Cluster::GetVertSize();
+        const uint64 indexes_end = uint64(entry.indexes_offset) + uint64(entry.num_tris) * 3;
+        const uint64 tris_end    = uint64(entry.tris_offset) + entry.num_tris;
+        if (verts_end > m_header.num_vert_floats || indexes_end > m_header.num_cluster_indexes ||
+            tris_end > m_header.num_cluster_tris) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline void ClusterBlobView::CopyClusters(std::vector<Cluster>& clusters) const {
+    const size_t base_cluster = clusters.size();
+    clusters.resize(base_cluster + m_entries.size());
+
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        const ClusterBlobEntry& entry   = m_entries[i];
+        Cluster&                cluster = clusters[base_cluster + i];
+
+        cluster.NumVerts = entry.num_verts;
+        cluster.NumTris  = entry.num_tris;
+        cluster.MipLevel = entry.mip_level;
+        cluster.GUID     = entry.guid;
+
+        auto verts     = GetVerts(entry);
+        auto indexes   = GetIndexes(entry);
+        auto materials = GetMaterialIndexes(entry);
+        cluster.Verts.assign(verts.begin(), verts.end());
+        cluster.Indexes.assign(indexes.begin(), indexes.end());
+        cluster.MaterialIndexes.assign(materials.begin(), materials.end());
+
+        cluster.Bounds = Bounds3f(
+            Vector3f(entry.bounds_min[0], entry.bounds_min[1], entry.bounds_min[2]),
+            Vector3f(entry.bounds_max[0], entry.bounds_max[1], entry.bounds_max[2])
+        );
+    }
+}
+
+// 保持文件映射的ClusterBlobView，命中缓存时可以直接读取映射的数据
+struct MappedClusterBlob {
+    MappedFile      file;
+    ClusterBlobView view;
+};
+
+// 以输入内容的128位哈希为key的磁盘缓存，命中时跳过ClusterTriangles
+class ClusterCache {
+public:
+    explicit ClusterCache(std::filesystem::path directory);
+
+    static Hash128 ComputeKey(
+        const MeshBuildVertexView&  verts,
+        const std::vector<uint32>&  indices,
+        const std::vector<int32>&   material_indexes,
+        const Bounds3f&             mesh_bounds,
+        const ClusterBuildSettings& settings
+    );
+
+    // 映射缓存文件，只读访问时不产生任何拷贝
+    bool Map(const Hash128& key, MappedClusterBlob& blob) const;
+    // 映射缓存文件并拷贝出Cluster数组
+    bool Load(const Hash128& key, std::vector<Cluster>& clusters, ClusterPartition* out_partition) const;
+    bool Store(const Hash128& key, const Cluster* clusters, size_t num_clusters, const ClusterPartition& partition)
+        const;
+
+    std::filesystem::path GetPath(const Hash128& key) const;
+
+private:
+    std::filesystem::path m_directory;
+};
+
+inline ClusterCache::ClusterCache(std::filesystem::path directory): m_directory(std::move(directory)) {
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+}
+
+inline Hash128 ClusterCache::ComputeKey(
+    const MeshBuildVertexView&  verts,
+    const std::vector<uint32>&  indices,
+    const std::vector<int32>&   material_indexes,
+    const Bounds3f&             mesh_bounds,
+    const ClusterBuildSettings& settings
+) {
+    // 影响构建结果的参数，任意一项改变都会使缓存失效
+    const uint32 config[] = {
+        ClusterBlobHeader::Version,
+        Cluster::ClusterSize,
+        static_cast<uint32>(settings.min_partition_size),
+        static_cast<uint32>(settings.max_partition_size),
+        settings.multi_threaded_threshold,
+        static_cast<uint32>(settings.deterministic),
+        static_cast<uint32>(settings.locality_search),
+        std::bit_cast<uint32>(settings.locality_radius),
+        static_cast<uint32>(settings.material_seam_cost),
+        settings.max_cluster_materials,
+        settings.max_cluster_vertices,
+        static_cast<uint32>(settings.optimize_vertex_cache),
+        static_cast<uint32>(verts.Positions.size()),
+        static_cast<uint32>(indices.size()),
+        static_cast<uint32>(material_indexes.size()),
+    };
+
+    // 包围盒决定局部连接使用的莫顿码，进而影响划分结果
+    const Vector3f bounds[] = { mesh_bounds.GetMin(), mesh_bounds.GetMax() };
+
+    Hash128 key = Murmur128(config, sizeof(config));
+    key         = Murmur128(bounds, sizeof(bounds), key);
+    key         = Murmur128(verts.Positions.data(), verts.Positions.size() * sizeof(Point3f), key);
+    key         = Murmur128(indices.data(), indices.size() * sizeof(uint32), key);
+    key         = Murmur128(material_indexes.data(), material_indexes.size() * sizeof(int32), key);
+    return key;
+}
+
+inline std::filesystem::path ClusterCache::GetPath(const Hash128& key) const {
+    // 使用key的前两位作为子目录，避免单个目录下文件过多
+    std::string name = key.ToString();
+    return m_directory / name.substr(0, 2) / (name + ".clusters");
+}
+
+inline bool ClusterCache::Map(const Hash128& key, MappedClusterBlob& blob) const {
+    if (!blob.file.Open(GetPath(key).string())) {
+        return false;
+    }
+
+    if (!blob.view.Parse(blob.file.Data(), blob.file.Size(), key)) {
+        blob.file.Close();
+        return false;
+    }
+    return true;
+}
+
+inline bool ClusterCache::Load(const Hash128& key, std::vector<Cluster>& clusters, ClusterPartition* out_partition)
+    const {
+    MappedClusterBlob blob;
+    if (!Map(key, blob)) {
+        return false;
+    }
+
+    // Cluster自己持有顶点和索引数组，只能从映射中拷贝；只读的调用者应该直接使用Map
+    blob.view.CopyClusters(clusters);
+    if (out_partition) {
+        out_partition->ranges.assign(blob.view.Ranges().begin(), blob.view.Ranges().end());
+        out_partition->indices.assign(blob.view.Indices().begin(), blob.view.Indices().end());
+    }
+    return true;
+}
+
+inline bool ClusterCache::Store(
+    const Hash128&          key,
+    const Cluster*          clusters,
+    size_t                  num_clusters,
+    const ClusterPartition& partition
+) const {
+    const std::filesystem::path path = GetPath(key);
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // 先写入临时文件再重命名，保证并发的构建进程不会读到写了一半的文件
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp" + std::to_string(std::random_device {}());
+
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        WriteClusterBlob(out, key, clusters, num_clusters, partition);
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
+
+// 带缓存的ClusterTriangles，cache为空时直接构建，返回是否命中缓存。
+// out_key不为空时返回输入的哈希，避免调用者再次哈希整个网格
+inline bool ClusterTrianglesCached(
+    const ClusterCache*         cache,
+    const MeshBuildVertexView&  verts,
+    const std::vector<uint32>&  indices,
+    const std::vector<int32>&   material_indexes,
+    std::vector<Cluster>&       clusters,
+    const Bounds3f&             mesh_bounds,
+    const ClusterBuildSettings& settings      = {},
+    ClusterPartition*           out_partition = nullptr,
+    Hash128*                    out_key       = nullptr,
+    BuildStats*                 stats         = nullptr
+) {
+    Hash128 key;
+    if (cache || out_key) {
+        key = ClusterCache::ComputeKey(verts, indices, material_indexes, mesh_bounds, settings);
+        if (out_key) {
+            *out_key = key;
+        }
+    }
+
+    if (!cache) {
+        ClusterTriangles(verts, indices, material_indexes, clusters, mesh_bounds, settings, out_partition, stats);
+        return false;
+    }
+
+    if (cache->Load(key, clusters, out_partition)) {
+        return true;
+    }
+
+    const size_t     base_cluster = clusters.size();
+    ClusterPartition partition;
+    ClusterTriangles(verts, indices, material_indexes, clusters, mesh_bounds, settings, &partition, stats);
+
+    cache->Store(key, clusters.data() + base_cluster, clusters.size() - base_cluster, partition);
+
+    if (out_partition) {
+        *out_partition = std::move(partition);
+    }
+    return false;
+}
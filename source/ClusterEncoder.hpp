@@ -0,0 +1,327 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "Parallel.hpp"
+
+#if defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define CLUSTER_DECODE_SSE2 1
+#endif
+
+struct ClusterEncodeSettings {
+    // 位置量化到步长为2^-position_precision的全局网格。所有cluster共用同一个网格，
+    // 相邻cluster共享的顶点解码后完全一致，不会产生裂缝
+    int32 position_precision = 8;
+};
+
+// 每个cluster编码后的固定大小头，数据从data_offset开始按字节对齐，依次为：
+// x、y、z三个平面的量化坐标 | 每个三角形的首索引和另外两个索引的zigzag差值 | 每个三角形的材质
+struct EncodedClusterHeader {
+    uint16 num_verts;
+    uint16 num_tris;
+    uint8  position_bits[3];
+    uint8  index_bits; // 三角形首个顶点索引的位数，不超过128个顶点时为7位
+    uint8  delta_bits; // 另外两个索引相对首索引差值的位数
+    uint8  material_bits;
+    uint8  pad[2];
+    int32  position_min[3]; // 全局网格上的量化最小坐标
+    int32  material_base;
+    uint32 data_offset;
+    uint32 data_size;
+
+    uint32 GetVertexBits() const { return uint32(position_bits[0]) + position_bits[1] + position_bits[2]; }
+    uint32 GetTriangleBits() const { return uint32(index_bits) + 2 * delta_bits + material_bits; }
+};
+
+static_assert(std::is_trivially_copyable_v<EncodedClusterHeader>);
+
+struct EncodedClusters {
+    ClusterEncodeSettings             settings;
+    std::vector<EncodedClusterHeader> headers;
+    std::vector<uint8>                data; // 末尾额外保留8字节，解码时可以直接读取64位
+
+    uint64 num_tris = 0;
+
+    const uint8* GetClusterData(uint32 cluster_index) const { return data.data() + headers[cluster_index].data_offset; }
+
+    size_t GetEncodedSize() const { return headers.size() * sizeof(EncodedClusterHeader) + data.size(); }
+    double GetBytesPerTriangle() const { return num_tris ? double(GetEncodedSize()) / num_tris : 0.0; }
+};
+
+// 按位写入预先清零的缓冲。只读写该字段覆盖的字节，多个线程可以同时写入相邻的cluster
+class ClusterBitWriter {
+public:
+    explicit ClusterBitWriter(uint8* data): m_data(data) {}
+
+    void Write(uint32 value, uint32 bits) {
+        const uint32 shift     = static_cast<uint32>(m_bit_pos & 7);
+        const uint32 num_bytes = (shift + bits + 7) >> 3;
+
+        uint64 word = 0;
+        std::memcpy(&word, m_data + (m_bit_pos >> 3), num_bytes);
+        word |= uint64(value) << shift;
+        std::memcpy(m_data + (m_bit_pos >> 3), &word, num_bytes);
+        m_bit_pos += bits;
+    }
+
+    uint64 GetBitPos() const { return m_bit_pos; }
+
+private:
+    uint8* m_data;
+    uint64 m_bit_pos = 0;
+};
+
+// 读取从bit_pos开始的bits位，bits不超过32
+inline uint32 ReadClusterBits(const uint8* data, uint64 bit_pos, uint32 bits) {
+    uint64 word;
+    std::memcpy(&word, data + (bit_pos >> 3), sizeof(word));
+    return static_cast<uint32>((word >> (bit_pos & 7)) & ((uint64(1) << bits) - 1));
+}
+
+inline uint32 ZigZagEncode(int32 value) {
+    return (static_cast<uint32>(value) << 1) ^ static_cast<uint32>(value >> 31);
+}
+
+inline int32 ZigZagDecode(uint32 value) {
+    return static_cast<int32>(value >> 1) ^ -static_cast<int32>(value & 1);
+}
+
+inline int32 QuantizePosition(float value, int32 precision) {
+    const double scaled = std::ldexp(double(value), precision);
+    CHECK(std::abs(scaled) < double(INT32_MAX));
+    return static_cast<int32>(std::floor(scaled + 0.5));
+}
+
+// 计算cluster编码后的头，data_offset由调用方分配
+inline EncodedClusterHeader ComputeClusterEncoding(const Cluster& cluster, const ClusterEncodeSettings& settings) {
+    CHECK(cluster.NumVerts <= 0xffff && cluster.NumTris <= 0xffff);
+
+    EncodedClusterHeader header {};
+    header.num_verts = static_cast<uint16>(cluster.NumVerts);
+    header.num_tris  = static_cast<uint16>(cluster.NumTris);
+
+    for (uint32 axis = 0; axis < 3; axis++) {
+        int32 min_q = INT32_MAX;
+        int32 max_q = INT32_MIN;
+        for (uint32 v = 0; v < cluster.NumVerts; v++) {
+            const float position = cluster.Verts[v * Cluster::GetVertSize() + axis];
+            const int32 q        = QuantizePosition(position, settings.position_precision);
+            min_q                = std::min(min_q, q);
+            max_q                = std::max(max_q, q);
+        }
+        if (cluster.NumVerts == 0) {
+            min_q = max_q = 0;
+        }
+
+        header.position_min[axis]  = min_q;
+        header.position_bits[axis] = static_cast<uint8>(std::bit_width(static_cast<uint32>(int64(max_q) - min_q)));
+    }
+
+    uint32 max_zigzag = 0;
+    for (uint32 tri_index = 0; tri_index < cluster.NumTris; tri_index++) {
+        const int32 i0 = static_cast<int32>(cluster.Indexes[tri_index * 3 + 0]);
+        for (uint32 k = 1; k < 3; k++) {
+            const int32 delta = static_cast<int32>(cluster.Indexes[tri_index * 3 + k]) - i0;
+            max_zigzag        = std::max(max_zigzag, ZigZagEncode(delta));
+        }
+    }
+    header.index_bits = static_cast<uint8>(std::bit_width(std::max(cluster.NumVerts, 1u) - 1));
+    header.delta_bits = static_cast<uint8>(std::bit_width(max_zigzag));
+
+    int32 min_material = 0;
+    int32 max_material = 0;
+    if (cluster.NumTris) {
+        auto [min_it, max_it] = std::minmax_element(cluster.MaterialIndexes.begin(), cluster.MaterialIndexes.end());
+        min_material          = *min_it;
+        max_material          = *max_it;
+    }
+    header.material_base = min_material;
+    header.material_bits = static_cast<uint8>(std::bit_width(static_cast<uint32>(int64(max_material) - min_material)));
+
+    const uint64 vertex_bits = uint64(header.GetVertexBits()) * cluster.NumVerts;
+    const uint64 tri_bits    = uint64(header.GetTriangleBits()) * cluster.NumTris;
+    header.data_size         = static_cast<uint32>(DivideAndRoundUp<uint64>(vertex_bits + tri_bits, 8));
+    return header;
+}
+
+inline void EncodeCluster(
+    const Cluster&               cluster,
+    const EncodedClusterHeader&  header,
+    const ClusterEncodeSettings& settings,
+    uint8*                       data
+) {
+    ClusterBitWriter writer(data);
+
+    for (uint32 axis = 0; axis < 3; axis++) {
+        for (uint32 v = 0; v < cluster.NumVerts; v++) {
+            const float position = cluster.Verts[v * Cluster::GetVertSize() + axis];
+            const int32 q        = QuantizePosition(position, settings.position_precision);
+            writer.Write(static_cast<uint32>(q - header.position_min[axis]), header.position_bits[axis]);
+        }
+    }
+
+    for (uint32 tri_index = 0; tri_index < cluster.NumTris; tri_index++) {
+        const uint32 i0 = cluster.Indexes[tri_index * 3 + 0];
+        writer.Write(i0, header.index_bits);
+        for (uint32 k = 1; k < 3; k++) {
+            const int32 delta = static_cast<int32>(cluster.Indexes[tri_index * 3 + k]) - static_cast<int32>(i0);
+            writer.Write(ZigZagEncode(delta), header.delta_bits);
+        }
+    }
+
+    for (uint32 tri_index = 0; tri_index < cluster.NumTris; tri_index++) {
+        const int32 material = cluster.MaterialIndexes[tri_index] - header.material_base;
+        writer.Write(static_cast<uint32>(material), header.material_bits);
+    }
+
+    CHECK(DivideAndRoundUp<uint64>(writer.GetBitPos(), 8) == header.data_size);
+}
+
+// 并行编码所有cluster：先计算每个cluster的大小，前缀和分配偏移后再并行写入
+inline EncodedClusters EncodeClusters(
+    const Cluster*               clusters,
+    size_t                       num_clusters,
+    const ClusterEncodeSettings& settings = {}
+) {
+    EncodedClusters encoded;
+    encoded.settings = settings;
+    encoded.headers.resize(num_clusters);
+
+    ParallelFor("EncodeClusters.ParallelFor", num_clusters, 64, [&](size_t index) {
+        encoded.headers[index] = ComputeClusterEncoding(clusters[index], settings);
+    });
+
+    uint64 data_size = 0;
+    for (size_t index = 0; index < num_clusters; index++) {
+        encoded.headers[index].data_offset = static_cast<uint32>(data_size);
+        encoded.num_tris += clusters[index].NumTris;
+
+        data_size += encoded.headers[index].data_size;
+        CHECK(data_size <= UINT32_MAX);
+    }
+    encoded.data.resize(data_size + sizeof(uint64), 0);
+
+    ParallelFor("EncodeClusters.ParallelFor", num_clusters, 64, [&](size_t index) {
+        const EncodedClusterHeader& header = encoded.headers[index];
+        EncodeCluster(clusters[index], header, settings, encoded.data.data() + header.data_offset);
+    });
+
+    return encoded;
+}
+
+// 标量解码顶点位置，data指向cluster数据的起始位置且之后至少还有8字节可读，out_positions按xyz交错存放
+inline void DecodeClusterPositionsScalar(
+    const uint8*                data,
+    const EncodedClusterHeader& header,
+    int32                       position_precision,
+    float*                      out_positions
+) {
+    const float step = std::ldexp(1.0f, -position_precision);
+
+    uint64 bit_pos = 0;
+    for (uint32 axis = 0; axis < 3; axis++) {
+        for (uint32 v = 0; v < header.num_verts; v++) {
+            const uint32 raw = ReadClusterBits(data, bit_pos, header.position_bits[axis]);
+            const int32  q   = static_cast<int32>(static_cast<uint32>(header.position_min[axis]) + raw);
+
+            out_positions[v * 3 + axis] = static_cast<float>(q) * step;
+            bit_pos += header.position_bits[axis];
+        }
+    }
+}
+
+// 每个顶点占用一个128位寄存器，反量化的加法、转换和乘法一次处理三个坐标，结果与标量解码逐位一致
+inline void DecodeClusterPositions(
+    const uint8*                data,
+    const EncodedClusterHeader& header,
+    int32                       position_precision,
+    float*                      out_positions
+) {
+#if defined(CLUSTER_DECODE_SSE2)
+    const uint32 num_verts = header.num_verts;
+
+    const uint64 plane_offset[3] = {
+        0,
+        uint64(header.position_bits[0]) * num_verts,
+        uint64(header.position_bits[0] + header.position_bits[1]) * num_verts,
+    };
+
+    auto ReadAxis = [&](uint32 axis, uint32 v) {
+        const uint32 bits = header.position_bits[axis];
+        return static_cast<int32>(ReadClusterBits(data, plane_offset[axis] + uint64(v) * bits, bits));
+    };
+
+    const __m128i position_min =
+        _mm_setr_epi32(header.position_min[0], header.position_min[1], header.position_min[2], 0);
+    const __m128 step = _mm_set1_ps(std::ldexp(1.0f, -position_precision));
+
+    for (uint32 v = 0; v < num_verts; v++) {
+        const __m128i raw      = _mm_setr_epi32(ReadAxis(0, v), ReadAxis(1, v), ReadAxis(2, v), 0);
+        const __m128  position = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(raw, position_min)), step);
+
+        if (v + 1 < num_verts) {
+            // 第四个分量会被下一个顶点覆盖
+            _mm_storeu_ps(out_positions + v * 3, position);
+        } else {
+            alignas(16) float last[4];
+            _mm_store_ps(last, position);
+            std::memcpy(out_positions + v * 3, last, 3 * sizeof(float));
+        }
+    }
+#else
+    DecodeClusterPositionsScalar(data, header, position_precision, out_positions);
+#endif
+}
+
+// 解码单个cluster，数据可以来自EncodedClusters，也可以来自直接读入内存的页
+inline void DecodeCluster(
+    const uint8*                data,
+    const EncodedClusterHeader& header,
+    int32                       position_precision,
+    Cluster&                    cluster
+) {
+    cluster          = Cluster();
+    cluster.NumVerts = header.num_verts;
+    cluster.NumTris  = header.num_tris;
+    cluster.Verts.resize(header.num_verts * Cluster::GetVertSize());
+    cluster.Indexes.resize(header.num_tris * 3);
+    cluster.MaterialIndexes.resize(header.num_tris);
+
+    DecodeClusterPositions(data, header, position_precision, cluster.Verts.data());
+
+    uint64 bit_pos = uint64(header.GetVertexBits()) * header.num_verts;
+    for (uint32 tri_index = 0; tri_index < header.num_tris; tri_index++) {
+        const uint32 i0 = ReadClusterBits(data, bit_pos, header.index_bits);
+        bit_pos += header.index_bits;
+
+        cluster.Indexes[tri_index * 3 + 0] = i0;
+        for (uint32 k = 1; k < 3; k++) {
+            const int32 delta = ZigZagDecode(ReadClusterBits(data, bit_pos, header.delta_bits));
+            bit_pos += header.delta_bits;
+
+            cluster.Indexes[tri_index * 3 + k] = static_cast<uint32>(static_cast<int32>(i0) + delta);
+        }
+    }
+
+    for (uint32 tri_index = 0; tri_index < header.num_tris; tri_index++) {
+        cluster.MaterialIndexes[tri_index] =
+            header.material_base + static_cast<int32>(ReadClusterBits(data, bit_pos, header.material_bits));
+        bit_pos += header.material_bits;
+    }
+
+    cluster.Bound();
+}
+
+inline void DecodeClusters(const EncodedClusters& encoded, std::vector<Cluster>& clusters) {
+    clusters.resize(encoded.headers.size());
+    ParallelFor("DecodeClusters.ParallelFor", clusters.size(), 64, [&](size_t index) {
+        const uint32 cluster_index = static_cast<uint32>(index);
+        DecodeCluster(
+            encoded.GetClusterData(cluster_index),
+            encoded.headers[cluster_index],
+            encoded.settings.position_precision,
+            clusters[index]
+        );
+    });
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "Parallel.hpp"
+#include "GraphPartitioner.hpp"
+
+#include <span>
+
+struct ClusterMaterialReport {
+    uint64 num_clusters       = 0;
+    uint64 num_materials      = 0; // 每个cluster中不同材质数量的总和
+    uint64 num_multi_material = 0; // 包含多个材质的cluster数
+    uint32 max_materials      = 0;
+
+    double GetAverageMaterials() const { return num_clusters ? double(num_materials) / num_clusters : 0.0; }
+};
+
+// 统计每个cluster中不同材质的数量
+inline ClusterMaterialReport ComputeClusterMaterialReport(const Cluster* clusters, size_t num_clusters) {
+    std::vector<uint32> num_materials(num_clusters);
+    ParallelFor("ComputeClusterMaterialReport.ParallelFor", num_clusters, 64, [&](size_t index) {
+        std::vector<int32> materials = clusters[index].MaterialIndexes;
+        std::sort(materials.begin(), materials.end());
+        num_materials[index] = static_cast<uint32>(std::unique(materials.begin(), materials.end()) - materials.begin());
+    });
+
+    ClusterMaterialReport report;
+    report.num_clusters = num_clusters;
+    for (uint32 count: num_materials) {
+        report.num_materials += count;
+        report.num_multi_material += count > 1 ? 1 : 0;
+        report.max_materials = std::max(report.max_materials, count);
+    }
+    return report;
+}
+
+// 将材质数超过max_materials的分区拆开。分区内的元素按材质稳定排序，同一材质的元素保持原有的空间顺序，
+// 再按材质顺序依次分组，每组不超过max_materials种材质。拆分后的分区仍按原来的顺序排列，返回新增的分区数
+inline uint32 SplitPartitionsByMaterial(
+    std::vector<GraphPartitioner::Range>& ranges,
+    std::vector<uint32>&                  indices,
+    std::span<const int32>                material_indexes,
+    uint32                                max_materials
+) {
+    CHECK(max_materials > 0);
+    if (material_indexes.empty()) {
+        return 0;
+    }
+
+    std::vector<std::vector<GraphPartitioner::Range>> split_ranges(ranges.size());
+    ParallelFor("SplitPartitionsByMaterial.ParallelFor", ranges.size(), 64, [&](size_t index) {
+        const GraphPartitioner::Range range = ranges[index];
+
+        // 材质数没有超出的分区保持原样
+        thread_local std::vector<int32> materials;
+        materials.clear();
+        for (uint32 i = range.begin; i < range.end; i++) {
+            materials.push_back(material_indexes[indices[i]]);
+        }
+        std::sort(materials.begin(), materials.end());
+        if (std::unique(materials.begin(), materials.end()) - materials.begin() <= max_materials) {
+            return;
+        }
+
+        auto begin = indices.begin() + range.begin;
+        auto end   = indices.begin() + range.end;
+        std::stable_sort(begin, end, [&](uint32 a, uint32 b) { return material_indexes[a] < material_indexes[b]; });
+
+        uint32 group_begin   = range.begin;
+        uint32 num_materials = 1;
+        for (uint32 i = range.begin + 1; i < range.end; i++) {
+            if (material_indexes[indices[i]] == material_indexes[indices[i - 1]]) {
+                continue;
+            }
+            if (num_materials == max_materials) {
+                split_ranges[index].push_back({ group_begin, i });
+                group_begin   = i;
+                num_materials = 0;
+            }
+            num_materials++;
+        }
+        if (group_begin != range.begin) {
+            split_ranges[index].push_back({ group_begin, range.end });
+        }
+    });
+
+    std::vector<GraphPartitioner::Range> new_ranges;
+    new_ranges.reserve(ranges.size());
+    for (size_t index = 0; index < ranges.size(); index++) {
+        if (split_ranges[index].empty()) {
+            new_ranges.push_back(ranges[index]);
+        } else {
+            new_ranges.insert(new_ranges.end(), split_ranges[index].begin(), split_ranges[index].end());
+        }
+    }
+
+    const uint32 num_added = static_cast<uint32>(new_ranges.size() - ranges.size());
+    ranges                 = std::move(new_ranges);
+    return num_added;
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "ClusterEncoder.hpp"
+#include "GraphPartitioner.hpp"
+#include "MappedFile.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <span>
+
+// 分页文件布局，每一页都按page_size对齐，运行时一次I/O读入一页即可解码其中的所有cluster：
+// ClusterPageFileHeader | ClusterPageEntry[num_pages] | uint32[num_dependencies] | uint32[num_clusters]
+// | 填充到page_size | 页0 | 页1 | ...
+// 每一页内为 EncodedClusterHeader[num_clusters] | 编码数据 | 填充到page_size，头中的data_offset相对于页的起始位置
+struct ClusterPageFileHeader {
+    static const uint32 Magic   = 0x4750434e; // "NCPG"
+    static const uint32 Version = 1;
+
+    uint32 magic;
+    uint32 version;
+    uint32 page_size;
+    uint32 num_pages;
+    uint32 num_clusters;
+    uint32 num_dependencies;
+    int32  position_precision;
+    uint32 pad;
+    uint64 pages_offset; // 第一页在文件中的偏移，是page_size的整数倍
+};
+
+struct ClusterPageEntry {
+    uint32 first_cluster; // 页内第一个cluster在打包顺序中的索引
+    uint32 num_clusters;
+    uint32 data_size; // 页内实际使用的字节数
+    uint32 first_dependency;
+    uint32 num_dependencies; // 与该页共享cluster组的其他页，需要一起载入
+};
+
+static_assert(std::is_trivially_copyable_v<ClusterPageFileHeader>);
+static_assert(std::is_trivially_copyable_v<ClusterPageEntry>);
+static_assert(sizeof(ClusterPageFileHeader) % alignof(ClusterPageEntry) == 0);
+
+struct ClusterPageSettings {
+    // 页大小，必须是2的幂，至少能放下一个最大的cluster
+    uint32 page_size = 128 * 1024;
+};
+
+// 页内的cluster数据之后保留8字节，解码时的64位读取不会越过页
+static constexpr uint32 ClusterPageTailPadding = sizeof(uint64);
+
+struct ClusterPageLayout {
+    uint32 page_size = 0;
+
+    std::vector<ClusterPageEntry> pages;
+    std::vector<uint32>           dependencies;
+    std::vector<uint32>           cluster_order; // 打包顺序中的第i个cluster对应的原始cluster索引
+
+    uint64 GetPagesOffset() const;
+    uint64 GetFileSize() const { return GetPagesOffset() + uint64(pages.size()) * page_size; }
+
+    // 页的平均填充率
+    double GetFillRatio() const;
+};
+
+inline uint64 ClusterPageLayout::GetPagesOffset() const {
+    const uint64 table_size = sizeof(ClusterPageFileHeader) + pages.size() * sizeof(ClusterPageEntry) +
+                              (dependencies.size() + cluster_order.size()) * sizeof(uint32);
+    return DivideAndRoundUp<uint64>(table_size, page_size) * page_size;
+}
+
+inline double ClusterPageLayout::GetFillRatio() const {
+    uint64 used = 0;
+    for (const ClusterPageEntry& page: pages) {
+        used += page.data_size;
+    }
+    return pages.empty() ? 0.0 : double(used) / (double(page_size) * pages.size());
+}
+
+// 将编码后的cluster按空间顺序装入固定大小的页。
+// cluster_groups为每个cluster所属的组（例如DAG中一起简化的cluster组），为空时每个cluster自成一组。
+// 同一组的cluster尽量放在同一页，放不下时跨越的页互相记录为依赖
+inline ClusterPageLayout PackClusterPages(
+    const Cluster*             clusters,
+    const EncodedClusters&     encoded,
+    std::span<const uint32>    cluster_groups,
+    const ClusterPageSettings& settings = {}
+) {
+    const uint32 num_clusters = static_cast<uint32>(encoded.headers.size());
+    CHECK(std::has_single_bit(settings.page_size));
+    CHECK(cluster_groups.empty() || cluster_groups.size() == num_clusters);
+
+    const uint32 page_capacity = settings.page_size - ClusterPageTailPadding;
+    auto         GetClusterSize = [&encoded](uint32 cluster_index) {
+        return uint32(sizeof(EncodedClusterHeader)) + encoded.headers[cluster_index].data_size;
+    };
+
+    // 按组收集cluster，组内保持原有顺序
+    std::vector<uint32> group_of(num_clusters);
+    uint32              num_groups = 0;
+    {
+        std::unordered_map<uint32, uint32> group_remap;
+        for (uint32 i = 0; i < num_clusters; i++) {
+            const uint32 group_id = cluster_groups.empty() ? i : cluster_groups[i];
+            group_of[i]           = group_remap.try_emplace(group_id, num_groups).first->second;
+            num_groups            = static_cast<uint32>(group_remap.size());
+        }
+    }
+
+    std::vector<uint32>   group_offsets(num_groups + 1, 0);
+    std::vector<Bounds3f> group_bounds(num_groups);
+    Bounds3f              all_bounds;
+    for (uint32 i = 0; i < num_clusters; i++) {
+        group_offsets[group_of[i] + 1]++;
+        group_bounds[group_of[i]].AddBoundingBox(clusters[i].Bounds);
+        all_bounds.AddBoundingBox(clusters[i].Bounds);
+    }
+    for (uint32 g = 0; g < num_groups; g++) {
+        group_offsets[g + 1] += group_offsets[g];
+    }
+
+    std::vector<uint32> group_clusters(num_clusters);
+    {
+        std::vector<uint32> cursor(group_offsets.begin(), group_offsets.end() - 1);
+        for (uint32 i = 0; i < num_clusters; i++) {
+            group_clusters[cursor[group_of[i]]++] = i;
+        }
+    }
+
+    // 组按包围盒中心的莫顿码排序，空间上接近的组落在相邻的页
+    std::vector<uint32> group_order(num_groups);
+    std::vector<uint32> group_keys(num_groups);
+    for (uint32 g = 0; g < num_groups; g++) {
+        group_order[g] = g;
+        group_keys[g]  = MortonKey3(group_bounds[g].GetCenter(), all_bounds);
+    }
+    std::stable_sort(group_order.begin(), group_order.end(), [&group_keys](uint32 a, uint32 b) {
+        return group_keys[a] < group_keys[b];
+    });
+
+    ClusterPageLayout layout;
+    layout.page_size = settings.page_size;
+    layout.cluster_order.reserve(num_clusters);
+
+    // 每个组占用的页区间，用于建立页之间的依赖
+    std::vector<std::pair<uint32, uint32>> group_pages;
+    group_pages.reserve(num_groups);
+
+    auto NewPage = [&layout]() {
+        layout.pages.push_back({ static_cast<uint32>(layout.cluster_order.size()), 0, 0, 0, 0 });
+    };
+
+    for (uint32 g: group_order) {
+        uint32 group_size = 0;
+        for (uint32 i = group_offsets[g]; i < group_offsets[g + 1]; i++) {
+            group_size += GetClusterSize(group_clusters[i]);
+        }
+
+        // 当前页放不下整组而一个空页可以放下时换页，让整组落在同一页
+        if (layout.pages.empty() ||
+            (layout.pages.back().data_size + group_size > page_capacity && group_size <= page_capacity)) {
+            NewPage();
+        }
+
+        uint32 first_page = ~0u;
+        for (uint32 i = group_offsets[g]; i < group_offsets[g + 1]; i++) {
+            const uint32 cluster_index = group_clusters[i];
+            const uint32 cluster_size  = GetClusterSize(cluster_index);
+            CHECK(cluster_size <= page_capacity);
+
+            if (layout.pages.back().data_size + cluster_size > page_capacity) {
+                NewPage();
+            }
+            if (first_page == ~0u) {
+                first_page = static_cast<uint32>(layout.pages.size() - 1);
+            }
+
+            layout.pages.back().num_clusters++;
+            layout.pages.back().data_size += cluster_size;
+            layout.cluster_order.push_back(cluster_index);
+        }
+        group_pages.emplace_back(first_page, static_cast<uint32>(layout.pages.size()));
+    }
+
+    // 跨页的组使其占用的每一页都依赖组内的其他页
+    std::vector<std::vector<uint32>> page_dependencies(layout.pages.size());
+    for (const auto& [first_page, end_page]: group_pages) {
+        for (uint32 page = first_page; page < end_page; page++) {
+            for (uint32 other = first_page; other < end_page; other++) {
+                if (other != page) {
+                    page_dependencies[page].push_back(other);
+                }
+            }
+        }
+    }
+
+    for (uint32 page = 0; page < layout.pages.size(); page++) {
+        std::vector<uint32>& dependencies = page_dependencies[page];
+        std::sort(dependencies.begin(), dependencies.end());
+        dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+
+        layout.pages[page].first_dependency = static_cast<uint32>(layout.dependencies.size());
+        layout.pages[page].num_dependencies = static_cast<uint32>(dependencies.size());
+        layout.dependencies.insert(layout.dependencies.end(), dependencies.begin(), dependencies.end());
+    }
+
+    return layout;
+}
+
+// 生成一页的完整内容，page的大小为page_size
+inline void BuildClusterPage(
+    const EncodedClusters&   encoded,
+    const ClusterPageLayout& layout,
+    uint32                   page_index,
+    std::span<uint8>         page
+) {
+    CHECK(page.size() == layout.page_size);
+    std::memset(page.data(), 0, page.size());
+
+    const ClusterPageEntry& entry       = layout.pages[page_index];
+    uint32                  data_offset = entry.num_clusters * sizeof(EncodedClusterHeader);
+    for (uint32 i = 0; i < entry.num_clusters; i++) {
+        const uint32 cluster_index = layout.cluster_order[entry.first_cluster + i];
+
+        EncodedClusterHeader header = encoded.headers[cluster_index];
+        header.data_offset          = data_offset;
+        std::memcpy(page.data() + i * sizeof(EncodedClusterHeader), &header, sizeof(header));
+        std::memcpy(page.data() + data_offset, encoded.GetClusterData(cluster_index), header.data_size);
+
+        data_offset += header.data_size;
+    }
+    CHECK(data_offset == entry.data_size);
+}
+
+// 写入分页文件，先写临时文件再重命名
+inline bool WriteClusterPages(
+    const std::filesystem::path& path,
+    const EncodedClusters&       encoded,
+    const ClusterPageLayout&     layout
+) {
+    ClusterPageFileHeader header {};
+    header.magic              = ClusterPageFileHeader::Magic;
+    header.version            = ClusterPageFileHeader::Version;
+    header.page_size          = layout.page_size;
+    header.num_pages          = static_cast<uint32>(layout.pages.size());
+    header.num_clusters       = static_cast<uint32>(layout.cluster_order.size());
+    header.num_dependencies   = static_cast<uint32>(layout.dependencies.size());
+    header.position_precision = encoded.settings.position_precision;
+    header.pages_offset       = layout.GetPagesOffset();
+
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp" + std::to_string(std::random_device {}());
+
+    std::error_code error;
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        auto Write = [&out](const void* data, size_t size) {
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        };
+
+        std::vector<uint8> page(layout.page_size);
+
+        Write(&header, sizeof(header));
+        Write(layout.pages.data(), layout.pages.size() * sizeof(ClusterPageEntry));
+        Write(layout.dependencies.data(), layout.dependencies.size() * sizeof(uint32));
+        Write(layout.cluster_order.data(), layout.cluster_order.size() * sizeof(uint32));
+
+        const uint64 table_size = static_cast<uint64>(out.tellp());
+        std::memset(page.data(), 0, page.size());
+        Write(page.data(), header.pages_offset - table_size);
+
+        for (uint32 page_index = 0; page_index < layout.pages.size() && out; page_index++) {
+            BuildClusterPage(encoded, layout, page_index, page);
+            Write(page.data(), page.size());
+        }
+
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
+
+// 指向分页文件的只读视图。页表和依赖在文件开头，页数据可以通过内存映射访问，
+// 也可以按GetPageOffset给出的偏移直接读取page_size字节
+class ClusterPageFileView {
+public:
+    // 校验文件头和页表，数据不完整时返回false
+    bool Parse(const uint8* data, size_t size);
+
+    const ClusterPageFileHeader& Header() const { return m_header; }
+
+    std::span<const ClusterPageEntry> Pages() const { return m_pages; }
+    std::span<const uint32>           ClusterOrder() const { return m_cluster_order; }
+
+    std::span<const uint32> GetDependencies(uint32 page_index) const {
+        return m_dependencies.subspan(m_pages[page_index].first_dependency, m_pages[page_index].num_dependencies);
+    }
+
+    uint64 GetPageOffset(uint32 page_index) const {
+        return m_header.pages_offset + uint64(page_index) * m_header.page_size;
+    }
+
+    const uint8* GetPage(uint32 page_index) const { return m_data + GetPageOffset(page_index); }
+
+private:
+    ClusterPageFileHeader m_header {};
+    const uint8*          m_data = nullptr;
+
+    std::span<const ClusterPageEntry> m_pages;
+    std::span<const uint32>           m_dependencies;
+    std::span<const uint32>           m_cluster_order;
+};
+
+inline bool ClusterPageFileView::Parse(const uint8* data, size_t size) {
+    if (size < sizeof(ClusterPageFileHeader) || reinterpret_cast<uintptr_t>(data) % alignof(ClusterPageEntry) != 0) {
+        return false;
+    }
+
+    std::memcpy(&m_header, data, sizeof(m_header));
+    if (m_header.magic != ClusterPageFileHeader::Magic || m_header.version != ClusterPageFileHeader::Version ||
+        !std::has_single_bit(m_header.page_size)) {
+        return false;
+    }
+
+    const uint64 table_size = sizeof(ClusterPageFileHeader) + uint64(m_header.num_pages) * sizeof(ClusterPageEntry) +
+                              (uint64(m_header.num_dependencies) + m_header.num_clusters) * sizeof(uint32);
+    if (table_size > m_header.pages_offset ||
+        m_header.pages_offset + uint64(m_header.num_pages) * m_header.page_size != size) {
+        return false;
+    }
+
+    m_data = data;
+
+    const uint8* cursor = data + sizeof(ClusterPageFileHeader);
+    auto         Advance = [&cursor]<typename T>(std::span<const T>& view, uint32 num) {
+        view = std::span<const T>(reinterpret_cast<const T*>(cursor), num);
+        cursor += num * sizeof(T);
+    };
+
+    Advance(m_pages, m_header.num_pages);
+    Advance(m_dependencies, m_header.num_dependencies);
+    Advance(m_cluster_order, m_header.num_clusters);
+
+    // 校验页表，避免损坏的文件导致越界访问
+    for (const ClusterPageEntry& page: m_pages) {
+        if (uint64(page.first_cluster) + page.num_clusters > m_header.num_clusters ||
+            uint64(page.first_dependency) + page.num_dependencies > m_header.num_dependencies ||
+            uint64(page.data_size) + ClusterPageTailPadding > m_header.page_size ||
+            uint64(page.num_clusters) * sizeof(EncodedClusterHeader) > page.data_size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// 解码一页中的所有cluster并追加到clusters末尾，page为读入内存的整页数据
+inline bool DecodeClusterPage(
+    const uint8*            page,
+    const ClusterPageEntry& entry,
+    int32                   position_precision,
+    std::vector<Cluster>&   clusters
+) {
+    const size_t base_cluster = clusters.size();
+    clusters.resize(base_cluster + entry.num_clusters);
+
+    for (uint32 i = 0; i < entry.num_clusters; i++) {
+        EncodedClusterHeader header;
+        std::memcpy(&header, page + i * sizeof(EncodedClusterHeader), sizeof(header));
+        const uint64 num_bits = uint64(header.GetVertexBits()) * header.num_verts +
+                                uint64(header.GetTriangleBits()) * header.num_tris;
+        if (uint64(header.data_offset) + header.data_size > entry.data_size ||
+            DivideAndRoundUp<uint64>(num_bits, 8) != header.data_size) {
+            clusters.resize(base_cluster);
+            return false;
+        }
+
+        DecodeCluster(page + header.data_offset, header, position_precision, clusters[base_cluster + i]);
+    }
+    return true;
+}
+
+// 保持文件映射的分页视图
+struct MappedClusterPages {
+    MappedFile          file;
+    ClusterPageFileView view;
+
+    bool Open(const std::filesystem::path& path) {
+        return file.Open(path.string()) && view.Parse(file.Data(), file.Size());
+    }
+};
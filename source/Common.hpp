@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <cmath>
 
 #include <iostream>
@@ -26,6 +27,7 @@
 
 #define NOMINMAX
 
+using uint8  = uint8_t;
 using int16  = int16_t;
 using int32  = int32_t;
 using int64  = int64_t;
@@ -86,4 +88,110 @@ inline static uint32 Murmur32(std::initializer_list<uint32> init_list) {
 template<class T>
 inline static constexpr T DivideAndRoundUp(T Dividend, T Divisor) {
     return (Dividend + Divisor - 1) / Divisor;
-}
\ No newline at end of file
+}
+
+struct Hash128 {
+    uint64 low  = 0;
+    uint64 high = 0;
+
+    bool operator==(const Hash128& other) const { return low == other.low && high == other.high; }
+    bool operator!=(const Hash128& other) const { return !(*this == other); }
+
+    std::string ToString() const {
+        char buffer[33];
+        std::snprintf(
+            buffer,
+            sizeof(buffer),
+            "%016llx%016llx",
+            static_cast<unsigned long long>(high),
+            static_cast<unsigned long long>(low)
+        );
+        return buffer;
+    }
+};
+
+inline static uint64 MurmurFinalize64(uint64 hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// MurmurHash3_x64_128，以seed作为初始状态，可以将多段数据串联成一个哈希
+inline static Hash128 Murmur128(const void* data, size_t size, Hash128 seed = {}) {
+    const uint8* bytes      = static_cast<const uint8*>(data);
+    const size_t num_blocks = size / 16;
+
+    const uint64 c1 = 0x87c37b91114253d5ull;
+    const uint64 c2 = 0x4cf5ad432745937full;
+
+    uint64 h1 = seed.low;
+    uint64 h2 = seed.high;
+
+    // 每次处理16字节
+    for (size_t i = 0; i < num_blocks; i++) {
+        uint64 k1, k2;
+        std::memcpy(&k1, bytes + i * 16 + 0, sizeof(uint64));
+        std::memcpy(&k2, bytes + i * 16 + 8, sizeof(uint64));
+
+        k1 *= c1;
+        k1 = std::rotl(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+
+        h1 = std::rotl(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = std::rotl(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+
+        h2 = std::rotl(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // 处理剩余不足16字节的尾部
+    const uint8* tail      = bytes + num_blocks * 16;
+    const size_t remainder = size & 15;
+
+    if (remainder > 8) {
+        uint64 k2 = 0;
+        for (size_t i = 8; i < remainder; i++) {
+            k2 ^= static_cast<uint64>(tail[i]) << ((i - 8) * 8);
+        }
+        k2 *= c2;
+        k2 = std::rotl(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+
+    if (remainder > 0) {
+        uint64 k1 = 0;
+        for (size_t i = 0; i < std::min<size_t>(remainder, 8); i++) {
+            k1 ^= static_cast<uint64>(tail[i]) << (i * 8);
+        }
+        k1 *= c1;
+        k1 = std::rotl(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = MurmurFinalize64(h1);
+    h2 = MurmurFinalize64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    return { h1, h2 };
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "Common.hpp"
+#include "Parallel.hpp"
+
+#include <atomic>
 
 class DisjointSet {
 public:
@@ -9,16 +12,21 @@ public:
 
     void Init(uint32 size);
     void Reset();
+    void Free();
     void AddDefaulted(uint32 num = 1);
 
+    size_t GetAllocatedSize() const { return m_parents.capacity() * sizeof(uint32); }
+
     void   Union(uint32 x, uint32 y);
     void   UnionSequential(uint32 x, uint32 y);
+    void   UnionConcurrent(uint32 x, uint32 y);
     uint32 Find(uint32 i);
+    uint32 FindConcurrent(uint32 i);
 
     uint32 operator[](uint32 i) const { return m_parents[i]; }
 
 private:
-    std::vector<uint32> m_parents; // 数组存储的是每个节点的父节点索引
+    FirstTouchVector<uint32> m_parents; // 数组存储的是每个节点的父节点索引
 };
 
 inline DisjointSet::DisjointSet(uint32 size) {
@@ -27,15 +35,21 @@ inline DisjointSet::DisjointSet(uint32 size) {
 
 inline void DisjointSet::Init(uint32 size) {
     m_parents.resize(size);
-    for (uint32 i = 0; i < size; i++) {
+    ParallelFor("DisjointSet.ParallelFor", size, 16384, [&](uint32 i) {
         m_parents[i] = i; // 初始化每个节点的父节点是自己
-    }
+    });
 }
 
 inline void DisjointSet::Reset() {
     m_parents.clear();
 }
 
+// 释放全部内存，之后需要重新Init才能使用
+inline void DisjointSet::Free() {
+    m_parents.clear();
+    m_parents.shrink_to_fit();
+}
+
 inline void DisjointSet::AddDefaulted(uint32 num) {
     uint32 start = m_parents.size();
     uint32 end   = start + num;
@@ -98,6 +112,42 @@ inline void DisjointSet::UnionSequential(uint32 x, uint32 y) {
     }
 }
 
+// 可以在多个线程中同时调用的Union。根节点只会链接到更大的根节点下，所以无论合并顺序如何，
+// 每个连通区域的根节点总是其中最大的索引，结果与串行合并一致
+inline void DisjointSet::UnionConcurrent(uint32 x, uint32 y) {
+    while (true) {
+        x = FindConcurrent(x);
+        y = FindConcurrent(y);
+        if (x == y) {
+            return;
+        }
+        if (x < y) {
+            std::swap(x, y);
+        }
+
+        // y仍是根节点时才能链接，否则其他线程已经改变了y，重新查找
+        uint32 expected = y;
+        if (std::atomic_ref<uint32>(m_parents[y]).compare_exchange_weak(expected, x, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+// 可以与UnionConcurrent同时调用的Find，用路径减半压缩。父节点只会向更大的祖先移动，
+// 即使与其他线程交错写入，每个节点的父节点仍然是它的祖先
+inline uint32 DisjointSet::FindConcurrent(uint32 i) {
+    while (true) {
+        const uint32 parent = std::atomic_ref<uint32>(m_parents[i]).load(std::memory_order_relaxed);
+        if (parent == i) {
+            return i;
+        }
+
+        const uint32 grand_parent = std::atomic_ref<uint32>(m_parents[parent]).load(std::memory_order_relaxed);
+        std::atomic_ref<uint32>(m_parents[i]).store(grand_parent, std::memory_order_relaxed);
+        i = grand_parent;
+    }
+}
+
 // 确定每个三角形所属的cluster根节点，根节点就是这个独立的拓扑结构最大的索引（最后一个三角形）
 inline uint32 DisjointSet::Find(uint32 i) {
     // 根据i查找其根节点，同时压缩路径上的所有节点
@@ -3,17 +3,61 @@
 #include "Common.hpp"
 #include "HashTable.hpp"
 
-struct EdgeHash {
-    HashTable hash_table {};
-    EdgeHash(size_t num): hash_table { 1u << std::bit_floor(static_cast<uint32>(num)), static_cast<uint32>(num) } {}
+// 边的哈希表，IndexType为哈希表中存储边索引的类型
+template<typename IndexType>
+struct BasicEdgeHash {
+    BasicHashTable<IndexType> hash_table {};
+    // 哈希桶数量取不超过边数的最大2的幂，保证平均链长在1到2之间
+    BasicEdgeHash(size_t num):
+        hash_table { std::max(1u, std::bit_floor(static_cast<uint32>(num))), static_cast<uint32>(num) } {}
+
+    void   Free() { hash_table.Free(); }
+    size_t GetAllocatedSize() const { return hash_table.GetAllocatedSize(); }
+
+    // 桶的占用情况，HASH_TABLE_STATS开启时还包括ForAllMatching的探测统计
+    HashTableStats GetStats() const;
 
     template<typename FuncType>
     void AddConcurrent(int32 edge_index, FuncType&& GetPosition);
     template<typename FuncType1, typename FuncType2>
         requires std::invocable<FuncType1, int32> && std::same_as<std::invoke_result_t<FuncType1, int32>, Vector3f>
     void ForAllMatching(int32 edge_index, bool need_add, FuncType1&& GetPosition, FuncType2&& Function);
+
+#if HASH_TABLE_STATS
+    HashProbeCounters probe_counters;
+#endif
 };
 
+using EdgeHash   = BasicEdgeHash<uint32>;
+using EdgeHash16 = BasicEdgeHash<uint16>;
+
+// 一次性并行构建、之后只读的边哈希表，匹配结果与BasicEdgeHash相同。
+// 每个桶的边连续存放并保存完整的哈希值，查询时只对哈希值相同的边比较坐标
+template<typename IndexType>
+struct BasicStaticEdgeHash {
+    BasicStaticHashTable<IndexType> hash_table;
+
+    // 为[0, num_edges)的所有边建立哈希表，桶数量与BasicEdgeHash相同
+    template<typename FuncType>
+    void Build(uint32 num_edges, FuncType&& GetPosition);
+
+    void   Free() { hash_table.Free(); }
+    size_t GetAllocatedSize() const { return hash_table.GetAllocatedSize(); }
+
+    HashTableStats GetStats() const;
+
+    template<typename FuncType1, typename FuncType2>
+        requires std::invocable<FuncType1, int32> && std::same_as<std::invoke_result_t<FuncType1, int32>, Vector3f>
+    void ForAllMatching(int32 edge_index, FuncType1&& GetPosition, FuncType2&& Function) const;
+
+#if HASH_TABLE_STATS
+    mutable HashProbeCounters probe_counters;
+#endif
+};
+
+using StaticEdgeHash   = BasicStaticEdgeHash<uint32>;
+using StaticEdgeHash16 = BasicStaticEdgeHash<uint16>;
+
 inline static uint32 HashPosition(const Vector3f& position) {
     auto ToUint = [](float f) {
         union {
@@ -33,8 +77,9 @@ inline static uint32 Cycle3(uint32 value) {
     return value - value_mod3 + next_value_mod3;
 }
 
+template<typename IndexType>
 template<typename FuncType>
-inline void EdgeHash::AddConcurrent(int32 edge_index, FuncType&& GetPosition) {
+inline void BasicEdgeHash<IndexType>::AddConcurrent(int32 edge_index, FuncType&& GetPosition) {
     // 根据边索引获取坐标和其相邻坐标
     const Vector3f position0 = GetPosition(edge_index);
     const Vector3f position1 = GetPosition(Cycle3(edge_index));
@@ -51,9 +96,15 @@ inline void EdgeHash::AddConcurrent(int32 edge_index, FuncType&& GetPosition) {
 }
 
 // 匹配所有与自己共享顶点但是方向相反的边
+template<typename IndexType>
 template<typename FuncType1, typename FuncType2>
     requires std::invocable<FuncType1, int32> && std::same_as<std::invoke_result_t<FuncType1, int32>, Vector3f>
-inline void EdgeHash::ForAllMatching(int32 edge_index, bool need_add, FuncType1&& GetPosition, FuncType2&& Function) {
+inline void BasicEdgeHash<IndexType>::ForAllMatching(
+    int32       edge_index,
+    bool        need_add,
+    FuncType1&& GetPosition,
+    FuncType2&& Function
+) {
     // 根据边索引获取坐标和其相邻坐标
     const Vector3f position0 = GetPosition(edge_index);
     const Vector3f position1 = GetPosition(Cycle3(edge_index));
@@ -62,20 +113,93 @@ inline void EdgeHash::ForAllMatching(int32 edge_index, bool need_add, FuncType1&
     uint32 hash0 = HashPosition(position0);
     uint32 hash1 = HashPosition(position1);
 
-    // 继续将二者的哈希值映射为一个哈希值
-    uint32 hash = Murmur32({ hash0, hash1 });
+    // 方向相反的边以(hash1, hash0)的顺序加入哈希表
+    uint32 hash = Murmur32({ hash1, hash0 });
+
+    [[maybe_unused]] uint32 probes  = 0;
+    [[maybe_unused]] uint32 matches = 0;
 
     // 从头节点开始遍历该哈希桶所有边
     for (uint32 other_edge_index = hash_table.First(hash); hash_table.IsValid(other_edge_index);
          other_edge_index        = hash_table.Next(other_edge_index)) {
+#if HASH_TABLE_STATS
+        probes++;
+#endif
         // 匹配和当前边共享顶点但是方向相反的边，即两个三角形共享一条边
         if (position0 == GetPosition(Cycle3(other_edge_index)) && position1 == GetPosition(other_edge_index)) {
+#if HASH_TABLE_STATS
+            matches++;
+#endif
             Function(edge_index, other_edge_index);
         }
     }
 
+#if HASH_TABLE_STATS
+    probe_counters.Add(probes, matches);
+#endif
+
     // 如果有需要就加入到哈希表中
     if (need_add) {
-        hash_table.Add(Murmur32({ hash1, hash0 }), edge_index);
+        hash_table.Add(Murmur32({ hash0, hash1 }), edge_index);
     }
-}
\ No newline at end of file
+}
+
+template<typename IndexType>
+inline HashTableStats BasicEdgeHash<IndexType>::GetStats() const {
+    HashTableStats stats;
+    hash_table.ComputeStats(stats);
+#if HASH_TABLE_STATS
+    probe_counters.Fill(stats);
+#endif
+    return stats;
+}
+
+template<typename IndexType>
+template<typename FuncType>
+inline void BasicStaticEdgeHash<IndexType>::Build(uint32 num_edges, FuncType&& GetPosition) {
+    const uint32 hash_size = std::max(1u, std::bit_floor(num_edges));
+    hash_table.Build(hash_size, num_edges, [&GetPosition](uint32 edge_index) {
+        const uint32 hash0 = HashPosition(GetPosition(edge_index));
+        const uint32 hash1 = HashPosition(GetPosition(Cycle3(edge_index)));
+        return Murmur32({ hash0, hash1 });
+    });
+}
+
+template<typename IndexType>
+template<typename FuncType1, typename FuncType2>
+    requires std::invocable<FuncType1, int32> && std::same_as<std::invoke_result_t<FuncType1, int32>, Vector3f>
+inline void BasicStaticEdgeHash<IndexType>::ForAllMatching(
+    int32       edge_index,
+    FuncType1&& GetPosition,
+    FuncType2&& Function
+) const {
+    const Vector3f position0 = GetPosition(edge_index);
+    const Vector3f position1 = GetPosition(Cycle3(edge_index));
+
+    // 方向相反的边的哈希值是(hash1, hash0)的组合
+    const uint32 hash = Murmur32({ HashPosition(position1), HashPosition(position0) });
+
+    [[maybe_unused]] uint32 matches = 0;
+    [[maybe_unused]] uint32 probes  = hash_table.ForAll(hash, [&](uint32 other_edge_index) {
+        if (position0 == GetPosition(Cycle3(other_edge_index)) && position1 == GetPosition(other_edge_index)) {
+#if HASH_TABLE_STATS
+            matches++;
+#endif
+            Function(edge_index, static_cast<int32>(other_edge_index));
+        }
+    });
+
+#if HASH_TABLE_STATS
+    probe_counters.Add(probes, matches);
+#endif
+}
+
+template<typename IndexType>
+inline HashTableStats BasicStaticEdgeHash<IndexType>::GetStats() const {
+    HashTableStats stats;
+    hash_table.ComputeStats(stats);
+#if HASH_TABLE_STATS
+    probe_counters.Fill(stats);
+#endif
+    return stats;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Parallel.hpp"
+#include "EdgeHash.hpp"
+#include "Adjacency.hpp"
+
+#include <utility>
+
+// 边匹配的实现方式，两种方式得到的邻接关系完全相同
+enum class EdgeMatchEngine : uint8 {
+    Hash, // 并发插入链式哈希表，逐条边查询
+    Sort, // 按边的键并行基数排序，扫描相同键的区间
+};
+
+// 64位键的并行LSD基数排序，values随键一起移动，相同的键保持原有顺序。
+// 按固定大小分块统计和分发，结果与线程数无关
+inline void ParallelRadixSort64(FirstTouchVector<uint64>& keys, FirstTouchVector<uint32>& values) {
+    constexpr uint32 RadixBits = 11;
+    constexpr uint32 RadixSize = 1u << RadixBits;
+    constexpr uint32 ChunkSize = 1u << 16;
+
+    const uint32 num        = static_cast<uint32>(keys.size());
+    const uint32 num_chunks = DivideAndRoundUp(num, ChunkSize);
+    CHECK(values.size() == num);
+
+    FirstTouchVector<uint64> temp_keys(num);
+    FirstTouchVector<uint32> temp_values(num);
+    std::vector<uint32> offsets(size_t(num_chunks) * RadixSize);
+
+    for (uint32 shift = 0; shift < 64; shift += RadixBits) {
+        // 每个块分别统计各数位的数量
+        ParallelFor("RadixSort64.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+            uint32*      counts = offsets.data() + chunk * RadixSize;
+            const uint32 begin  = static_cast<uint32>(chunk) * ChunkSize;
+            const uint32 end    = std::min(begin + ChunkSize, num);
+            std::fill(counts, counts + RadixSize, 0u);
+            for (uint32 i = begin; i < end; i++) {
+                counts[(keys[i] >> shift) & (RadixSize - 1)]++;
+            }
+        });
+
+        // 按数位优先、块次之的顺序求前缀和，同一数位内前面的块先放，保证排序稳定
+        uint32 offset       = 0;
+        bool   single_digit = false;
+        for (uint32 digit = 0; digit < RadixSize; digit++) {
+            const uint32 digit_begin = offset;
+            for (uint32 chunk = 0; chunk < num_chunks; chunk++) {
+                uint32& count = offsets[size_t(chunk) * RadixSize + digit];
+                offset += std::exchange(count, offset);
+            }
+            single_digit |= offset - digit_begin == num;
+        }
+
+        // 所有键的这一位都相同，跳过这一趟
+        if (single_digit) {
+            continue;
+        }
+
+        ParallelFor("RadixSort64.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+            uint32*      chunk_offsets = offsets.data() + chunk * RadixSize;
+            const uint32 begin         = static_cast<uint32>(chunk) * ChunkSize;
+            const uint32 end           = std::min(begin + ChunkSize, num);
+            for (uint32 i = begin; i < end; i++) {
+                const uint32 dst = chunk_offsets[(keys[i] >> shift) & (RadixSize - 1)]++;
+                temp_keys[dst]   = keys[i];
+                temp_values[dst] = values[i];
+            }
+        });
+
+        std::swap(keys, temp_keys);
+        std::swap(values, temp_values);
+    }
+}
+
+// 基于排序的边匹配，得到与BasicEdgeHash相同的直接邻接。
+// 每条有向边的键由两个端点坐标的哈希按大小排列组成，与方向无关，方向相反的边排序后落在同一段相同的键中，
+// 段内再逐个比较坐标排除哈希冲突。复杂边的所有匹配按(边, 匹配边)排序后写入complex_links
+template<typename IndexType, typename FuncType>
+    requires std::invocable<FuncType, int32> && std::same_as<std::invoke_result_t<FuncType, int32>, Vector3f>
+inline void MatchEdgesSorted(
+    uint32                                num_edges,
+    FuncType&&                            GetPosition,
+    BasicAdjacency<IndexType>&            adjacency,
+    std::vector<std::pair<int32, int32>>& complex_links
+) {
+    FirstTouchVector<uint64> keys(num_edges);
+    FirstTouchVector<uint32> edges(num_edges);
+    ParallelFor("MatchEdgesSorted.ParallelFor", num_edges, 4096, [&](uint32 edge_index) {
+        const uint64 hash0 = HashPosition(GetPosition(edge_index));
+        const uint64 hash1 = HashPosition(GetPosition(Cycle3(edge_index)));
+        keys[edge_index]   = std::min(hash0, hash1) << 32 | std::max(hash0, hash1);
+        edges[edge_index]  = edge_index;
+    });
+
+    ParallelRadixSort64(keys, edges);
+
+    // 和BasicEdgeHash::ForAllMatching的匹配条件一致，退化边会匹配到自己
+    auto IsMatching = [&GetPosition](int32 edge_index, int32 other_edge_index) {
+        return GetPosition(edge_index) == GetPosition(Cycle3(other_edge_index)) &&
+               GetPosition(Cycle3(edge_index)) == GetPosition(other_edge_index);
+    };
+
+    // 每个块处理起点落在块内的段，段可以延伸到下一个块
+    constexpr uint32 ChunkSize  = 4096;
+    const uint32     num_chunks = DivideAndRoundUp(num_edges, ChunkSize);
+
+    std::vector<std::vector<std::pair<int32, int32>>> chunk_links(num_chunks);
+    ParallelFor("MatchEdgesSorted.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+        const uint32 chunk_begin = static_cast<uint32>(chunk) * ChunkSize;
+        const uint32 chunk_end   = std::min(chunk_begin + ChunkSize, num_edges);
+
+        uint32 begin = chunk_begin;
+        while (begin > 0 && begin < chunk_end && keys[begin - 1] == keys[begin]) {
+            begin++;
+        }
+
+        while (begin < chunk_end) {
+            uint32 end = begin + 1;
+            while (end < num_edges && keys[end] == keys[begin]) {
+                end++;
+            }
+
+            for (uint32 i = begin; i < end; i++) {
+                const int32 edge_index = edges[i];
+                int32       adj_index  = -1;
+                int32       adj_count  = 0;
+                for (uint32 k = begin; k < end; k++) {
+                    if (IsMatching(edge_index, edges[k])) {
+                        adj_index = edges[k];
+                        adj_count++;
+                    }
+                }
+
+                if (adj_count > 1) {
+                    adj_index = -2;
+                    for (uint32 k = begin; k < end; k++) {
+                        if (IsMatching(edge_index, edges[k])) {
+                            chunk_links[chunk].emplace_back(edge_index, edges[k]);
+                        }
+                    }
+                }
+                adjacency.SetDirect(edge_index, adj_index);
+            }
+            begin = end;
+        }
+    });
+
+    complex_links.clear();
+    for (const auto& links: chunk_links) {
+        complex_links.insert(complex_links.end(), links.begin(), links.end());
+    }
+    std::sort(complex_links.begin(), complex_links.end());
+}
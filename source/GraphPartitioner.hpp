@@ -3,13 +3,24 @@
 #include "METIS/metis.h"
 
 #include "Common.hpp"
+#include "Parallel.hpp"
 #include "DisjointSet.hpp"
+#include "PointGrid.hpp"
 #include "Math/BoundingBox.hpp"
+#include <atomic>
 #include <cstddef>
+#include <functional>
+#include <span>
 #include <stdexcept>
 #include <utility>
 #include <vector>
 
+// 为小岛上的元素寻找其他岛上邻近元素的方式
+enum class LocalityLinkSearch : uint8 {
+    MortonWindow, // 在莫顿码排序后的前后各16个元素中寻找
+    Grid, // 在质心的均匀网格中寻找真正的k个最近邻
+};
+
 class GraphPartitioner {
 public:
     struct GraphData {
@@ -19,6 +30,10 @@ public:
         std::vector<idx_t> adjacency {};
         std::vector<idx_t> adjacency_cost {};
         std::vector<idx_t> adjacency_offset {};
+
+        size_t GetAllocatedSize() const {
+            return (adjacency.capacity() + adjacency_cost.capacity() + adjacency_offset.capacity()) * sizeof(idx_t);
+        }
     };
 
     struct Range {
@@ -41,10 +56,10 @@ public:
 
     template<typename FuncType>
     void BuildLocalityLinks(
-        DisjointSet&              disjoint_set,
-        const Bounds3f&           bounds,
-        const std::vector<int32>& group_indices,
-        FuncType&                 GetCenter
+        DisjointSet&           disjoint_set,
+        const Bounds3f&        bounds,
+        std::span<const int32> group_indices,
+        FuncType&              GetCenter
     );
 
     void Partition(GraphData* graph);
@@ -54,16 +69,33 @@ public:
     void BisectGraph(GraphData* graph, GraphData* child_graphs[2]);
     void RecursiveBisectGraph(GraphData* graph);
 
+    bool IsPartitionValid(int32 offset, int32 num) const;
+    void MergeAdjacentPartitions();
+
+    size_t GetAllocatedSize() const;
+
     uint32 num_elements;
     int32  min_partition_size;
     int32  max_partition_size;
 
+    // 元素数量之外的分区限制，参数为分区内的元素索引，返回false时继续二分该分区。
+    // 并行二分时会被多个线程同时调用，为空时只限制元素数量
+    std::function<bool(const uint32* elements, uint32 num)> partition_fits;
+
+    // 多线程二分时分区按完成顺序添加，为true时按起始位置排序，分区顺序与单线程一致
+    bool deterministic = true;
+
+    // 局部连接的搜索方式，Grid方式只连接距离不超过locality_radius的元素，为0时不限制距离
+    LocalityLinkSearch locality_search = LocalityLinkSearch::MortonWindow;
+    float              locality_radius = 0.0f;
+
     std::atomic<uint32> num_parition;
 
     std::vector<idx_t> partition_ids;
     std::vector<int32> swapped_with;
 
-    std::multimap<int32, uint32> locality_links;
+    // 按元素排序的局部连接，同一元素的连接按添加的顺序排列
+    std::vector<std::pair<int32, uint32>> locality_links;
 };
 
 inline static constexpr uint32 MorotonCode3(uint32 x) {
@@ -85,6 +117,26 @@ inline static constexpr uint32 ReverseMortonCode3(uint32 x) {
     return x;
 }
 
+// 点在包围盒内的30位莫顿码，空间上接近的点其数值也更接近，高位的前缀对应八叉树中较粗的格子
+inline static uint32 MortonKey3(const Point3f& point, const Bounds3f& bounds) {
+    // 将坐标系转换到以包围盒最小点为原点的本地坐标系,除以包围盒的尺寸得到归一化的坐标
+    const Point3f offset = point - bounds.GetMin();
+    const Point3f extent = bounds.GetMax() - bounds.GetMin();
+
+    // 平面网格在某个轴上的尺寸为0，该轴统一映射到0，避免除零得到NaN
+    auto Quantize = [](float offset, float extent) {
+        float local = extent > 0.0f ? offset / extent : 0.0f;
+        return static_cast<uint32>(std::clamp(local, 0.0f, 1.0f) * 1023);
+    };
+
+    // 分别获取三个维度的莫顿码，将0到1的坐标放大为0到1023的整数
+    uint32 morton;
+    morton = MorotonCode3(Quantize(offset.x, extent.x));
+    morton |= MorotonCode3(Quantize(offset.y, extent.y)) << 1;
+    morton |= MorotonCode3(Quantize(offset.z, extent.z)) << 2;
+    return morton;
+}
+
 template<class FuncType>
 inline static void RadixSort32(uint32* RESTRICT dst, uint32* RESTRICT src, uint32 num, FuncType&& SortKey) {
     // 将莫顿码分割为低10位、中11位和高11位，对应1024个桶，2048个桶，2048个桶
@@ -185,10 +237,10 @@ inline static float MaxComponent(Vector3f v) {
 // 在空间上建立三角形的邻近关系
 template<typename FuncType>
 inline void GraphPartitioner::BuildLocalityLinks(
-    DisjointSet&              disjoint_set,
-    const Bounds3f&           bounds,
-    const std::vector<int32>& group_indices,
-    FuncType&                 GetCenter
+    DisjointSet&           disjoint_set,
+    const Bounds3f&        bounds,
+    std::span<const int32> group_indices,
+    FuncType&              GetCenter
 ) {
     std::vector<uint32> sort_keys; // 存储每个三角形质心的莫顿码
     sort_keys.resize(sort_keys.size() + num_elements);
@@ -197,17 +249,7 @@ inline void GraphPartitioner::BuildLocalityLinks(
     const bool enable_groups = !group_indices.empty();
 
     ParallelFor("BuildLocalityLinks.ParallelFor", num_elements, 4096, [&](uint32 index) {
-        Point3f center = GetCenter(index);
-        // 将坐标系转换到以包围盒最小点为原点的本地坐标系,除以包围盒的尺寸得到归一化的坐标
-        Point3f center_local = (center - bounds.GetMin()) / (bounds.GetMax() - bounds.GetMin());
-
-        // 将3D坐标映射为一维的莫顿码，空间上接近的坐标其数值也更接近
-        uint32 morton;
-        // 分别获取三个维度的莫顿码，将0到1的坐标放大为0到1023的整数
-        morton = MorotonCode3(static_cast<uint32>(center_local.x * 1023));
-        morton |= MorotonCode3(static_cast<uint32>(center_local.y * 1023)) << 1;
-        morton |= MorotonCode3(static_cast<uint32>(center_local.z * 1023)) << 2;
-        sort_keys[index] = morton;
+        sort_keys[index] = MortonKey3(GetCenter(index), bounds);
     });
 
     // 基数排序
@@ -256,77 +298,133 @@ inline void GraphPartitioner::BuildLocalityLinks(
         }
     }
 
-    // 遍历所有三角形，此时三角形索引是按照莫顿码排序后的indices
-    for (uint32 i = 0; i < num_elements; i++) {
-        uint32_t index = indices[i];
+    // 按固定大小分块并行搜索，每块的连接按串行的顺序写入块内数组，按块的顺序拼接后与串行的结果一致。
+    // 并查集在上面已经压缩了所有路径，这里只读取每个三角形的根节点
+    constexpr uint32 ChunkSize  = 4096;
+    const uint32     num_chunks = DivideAndRoundUp(num_elements, ChunkSize);
+
+    // 网格方式先在所有元素的质心上建立网格，之后只读
+    std::unique_ptr<PointGrid> grid;
+    if (locality_search == LocalityLinkSearch::Grid) {
+        std::vector<Point3f> centers(num_elements);
+        ParallelFor("BuildLocalityLinks.ParallelFor", num_elements, 4096, [&](uint32 index) {
+            centers[index] = GetCenter(index);
+        });
+        grid = std::make_unique<PointGrid>(centers, bounds);
+    }
 
-        // 若该三角形属于小于128个三角形的独立拓扑结构
-        uint32 range_size = island_ranges[i].end - island_ranges[i].begin + 1;
-        if (range_size < 128) {
-            uint32 island_id = disjoint_set[index];
-            int32  group_id  = enable_groups ? group_indices[index] : 0;
+    std::vector<std::vector<std::pair<int32, uint32>>> chunk_links(num_chunks);
+    ParallelFor("BuildLocalityLinks.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+        const uint32 chunk_begin = static_cast<uint32>(chunk) * ChunkSize;
+        const uint32 chunk_end   = std::min(chunk_begin + ChunkSize, num_elements);
 
-            Point3f center = GetCenter(index);
+        // 遍历块内的三角形，此时三角形索引是按照莫顿码排序后的indices
+        for (uint32 i = chunk_begin; i < chunk_end; i++) {
+            uint32_t index = indices[i];
 
-            const uint32 max_links = 5;
+            // 若该三角形属于小于128个三角形的独立拓扑结构
+            uint32 range_size = island_ranges[i].end - island_ranges[i].begin + 1;
+            if (range_size < 128) {
+                uint32 island_id = disjoint_set[index];
+                int32  group_id  = enable_groups ? group_indices[index] : 0;
 
-            // 初始化
-            uint32 closest_index[max_links];
-            float  closest_dist2[max_links];
-            for (auto k = 0; k < max_links; k++) {
-                closest_index[k] = ~0u;
-                closest_dist2[k] = FLT_MAX;
-            }
+                Point3f center = GetCenter(index);
+
+                const uint32 max_links = 5;
 
-            // 向前和向后搜索邻接adj的island
-            for (int direction = 0; direction < 2; direction++) {
-                // 向前不能超过0，向后不能超过size-1
-                uint32 limit = direction ? num_elements - 1 : 0;
-                uint32 step  = direction ? 1 : -1;
-
-                uint32 adj = i;
-                // 最多搜索16步
-                for (int32 it = 0; it < 16; it++) {
-                    if (adj == limit) break;
-                    adj += step;
-
-                    uint32 adj_index     = indices[adj];
-                    uint32 adj_island_id = disjoint_set[adj_index]; // 获取邻接三角形所属的island
-
-                    int32 adj_group_id = enable_groups ? group_indices[adj_index] : 0;
-
-                    // island相同 或者 group不匹配 则跳过整个区间
-                    if (island_id == adj_island_id || (group_id != adj_group_id)) {
-                        if (direction)
-                            adj = island_ranges[adj].end;
-                        else
-                            adj = island_ranges[adj].begin;
-                    } else {
-                        // 计算二者的距离，按最短距离优先存入数组，记录索引
-                        float adj_dist2 = Math::Vector3::DistanceSquared(center, GetCenter(adj_index));
-                        for (int k = 0; k < max_links; k++) {
-                            // 维护最多5个元素的最近邻居数组
-                            if (adj_dist2 < closest_dist2[k]) {
-                                std::swap(adj_dist2, closest_dist2[k]);
-                                std::swap(adj_index, closest_index[k]);
+                // 初始化
+                uint32 closest_index[max_links];
+                float  closest_dist2[max_links];
+                for (auto k = 0; k < max_links; k++) {
+                    closest_index[k] = ~0u;
+                    closest_dist2[k] = FLT_MAX;
+                }
+
+                if (grid) {
+                    // 其他岛上同一组的k个最近邻
+                    auto IsCandidate = [&](uint32 adj_index) {
+                        const int32 adj_group_id = enable_groups ? group_indices[adj_index] : 0;
+                        return disjoint_set[adj_index] != island_id && adj_group_id == group_id;
+                    };
+                    grid->FindNearest(center, locality_radius, max_links, IsCandidate, closest_index, closest_dist2);
+                } else {
+                    // 向前和向后搜索邻接adj的island
+                    for (int direction = 0; direction < 2; direction++) {
+                        // 向前不能超过0，向后不能超过size-1
+                        uint32 limit = direction ? num_elements - 1 : 0;
+                        uint32 step  = direction ? 1 : -1;
+
+                        uint32 adj = i;
+                        // 最多搜索16步
+                        for (int32 it = 0; it < 16; it++) {
+                            if (adj == limit) break;
+                            adj += step;
+
+                            uint32 adj_index     = indices[adj];
+                            uint32 adj_island_id = disjoint_set[adj_index]; // 获取邻接三角形所属的island
+
+                            int32 adj_group_id = enable_groups ? group_indices[adj_index] : 0;
+
+                            // island相同 或者 group不匹配 则跳过整个区间
+                            if (island_id == adj_island_id || (group_id != adj_group_id)) {
+                                if (direction)
+                                    adj = island_ranges[adj].end;
+                                else
+                                    adj = island_ranges[adj].begin;
+                            } else {
+                                // 计算二者的距离，按最短距离优先存入数组，记录索引
+                                float adj_dist2 = Math::Vector3::DistanceSquared(center, GetCenter(adj_index));
+                                for (int k = 0; k < max_links; k++) {
+                                    // 维护最多5个元素的最近邻居数组
+                                    if (adj_dist2 < closest_dist2[k]) {
+                                        std::swap(adj_dist2, closest_dist2[k]);
+                                        std::swap(adj_index, closest_index[k]);
+                                    }
+                                }
                             }
                         }
                     }
                 }
-            }
 
-            // 存储其局部连接性
-            for (int k = 0; k < max_links; k++) {
-                if (closest_index[k] != ~0u) {
-                    locality_links.emplace(index, closest_index[k]);
-                    locality_links.emplace(closest_index[k], index);
+                // 存储其局部连接性
+                for (int k = 0; k < max_links; k++) {
+                    if (closest_index[k] != ~0u) {
+                        chunk_links[chunk].emplace_back(index, closest_index[k]);
+                        chunk_links[chunk].emplace_back(closest_index[k], index);
+                    }
                 }
             }
         }
+    });
+
+    for (const auto& links: chunk_links) {
+        locality_links.insert(locality_links.end(), links.begin(), links.end());
+    }
+
+    // 按元素稳定排序，同一元素的连接保持添加的顺序
+    std::stable_sort(
+        locality_links.begin(),
+        locality_links.end(),
+        [](const std::pair<int32, uint32>& a, const std::pair<int32, uint32>& b) { return a.first < b.first; }
+    );
+}
+
+inline GraphPartitioner::GraphPartitioner(uint32 num_elements, int32 min_partition_size, int32 max_partition_size):
+    num_elements(num_elements),
+    min_partition_size(min_partition_size),
+    max_partition_size(max_partition_size),
+    num_parition(0) {
+    // 初始时indices就是元素自身的索引
+    indices.resize(num_elements);
+    for (uint32 i = 0; i < num_elements; i++) {
+        indices[i] = i;
     }
 }
 
-inline GraphPartitioner::GraphPartitioner(uint32 num_elements, int32 min_partition_size, int32 max_partition_size) {
+inline size_t GraphPartitioner::GetAllocatedSize() const {
+    return ranges.capacity() * sizeof(Range) + (indices.capacity() + sorted_to.capacity()) * sizeof(uint32) +
+           partition_ids.capacity() * sizeof(idx_t) + swapped_with.capacity() * sizeof(int32) +
+           locality_links.capacity() * sizeof(locality_links[0]);
 }
 
 inline GraphPartitioner::GraphData* GraphPartitioner::NewGraph(uint32 num_adjacency) const {
@@ -339,24 +437,38 @@ inline GraphPartitioner::GraphData* GraphPartitioner::NewGraph(uint32 num_adjace
     graph->adjacency_cost.reserve(num_adjacency);
     graph->adjacency_offset.resize(graph->adjacency_offset.size() + num_elements + 1);
 
-    return nullptr;
+    return graph;
 }
 
+// 图节点使用排序后的位置索引，所以邻接元素需要经过sorted_to映射
 inline void GraphPartitioner::AddAdjaceny(GraphData* graph, uint32 adj_index, idx_t cost) {
+    graph->adjacency.push_back(sorted_to[adj_index]);
+    graph->adjacency_cost.push_back(cost);
 }
 
+// 将该元素的所有局部连接作为额外的邻接边加入图中
 inline void GraphPartitioner::AddLocalityLinks(GraphData* graph, uint32 index, idx_t cost) {
+    auto it = std::lower_bound(
+        locality_links.begin(),
+        locality_links.end(),
+        static_cast<int32>(index),
+        [](const std::pair<int32, uint32>& link, int32 key) { return link.first < key; }
+    );
+    for (; it != locality_links.end() && it->first == static_cast<int32>(index); ++it) {
+        graph->adjacency.push_back(sorted_to[it->second]);
+        graph->adjacency_cost.push_back(cost);
+    }
 }
 
 inline void GraphPartitioner::Partition(GraphData* graph) {
-    // 图节点数小于等于最大分区大小时，执行多分区逻辑
-    if (graph->num <= max_partition_size) {
+    // 图节点数超过最大分区大小时，执行多分区逻辑
+    if (graph->num > max_partition_size) {
         partition_ids.resize(partition_ids.size() + num_elements);
 
         // 目标分区大小，去最大最小的均值
         const int32 target_partition_size = (min_partition_size + max_partition_size) / 2;
         // 向上取整计算分区数
-        const int32 target_num_partitions = DivideAndRoundUp(graph->num, target_num_partitions);
+        const int32 target_num_partitions = DivideAndRoundUp(graph->num, target_partition_size);
 
         idx_t num_constraints = 1;
         idx_t num_parts       = target_num_partitions;
@@ -425,7 +537,7 @@ inline void GraphPartitioner::Partition(GraphData* graph) {
         }
     }
 
-    // 图元素数量超过最大值，单分区
+    // 图元素数量不超过最大值，单分区
     else {
         ranges.push_back({ 0, num_elements });
     }
@@ -436,11 +548,242 @@ inline void GraphPartitioner::Partition(GraphData* graph) {
     }
 }
 
+// 严格划分，递归二分直到每个分区都不超过max_partition_size
 inline void GraphPartitioner::ParititionStrict(GraphData* graph, bool enable_threaded) {
+    partition_ids.resize(partition_ids.size() + num_elements);
+    swapped_with.resize(swapped_with.size() + num_elements);
+
+    // 分区会被原子地添加，不能扩容，所以按上界分配：除了只有一个元素的根图，
+    // 二分得到的每个分区至少有两个元素，分区数不会超过元素数的一半
+    const int32 num_partitions_expected = DivideAndRoundUp(graph->num, min_partition_size);
+    ranges.resize(std::max(1, DivideAndRoundUp(graph->num, 2)));
+    num_parition = 0;
+
+    if (enable_threaded && num_partitions_expected > 4) {
+        // 两个子图互不相交，可以在线程池中并行二分。
+        // BisectTask必须先于group声明，保证group析构时执行剩余任务仍能访问它
+        std::function<void(GraphData*)> BisectTask;
+        TaskGroup                       group;
+
+        BisectTask = [&](GraphData* graph) {
+            GraphData* child_graphs[2];
+            {
+                // 二分失败抛出异常时也要释放当前图
+                std::unique_ptr<GraphData> owned_graph(graph);
+                BisectGraph(graph, child_graphs);
+            }
+
+            if (child_graphs[0] && child_graphs[1]) {
+                // 较小的子图直接在当前线程递归，避免产生过多细碎的任务
+                if (child_graphs[0]->num > 4 * max_partition_size) {
+                    group.Run([&BisectTask, child_graph = child_graphs[0]] { BisectTask(child_graph); });
+                } else {
+                    RecursiveBisectGraph(child_graphs[0]);
+                }
+                BisectTask(child_graphs[1]);
+            }
+        };
+
+        BisectTask(graph);
+        group.Wait();
+    } else {
+        RecursiveBisectGraph(graph);
+    }
+
+    ranges.resize(num_parition);
+    ranges.shrink_to_fit();
+
+    if (enable_threaded && (deterministic || partition_fits)) {
+        // 多线程下分区的添加顺序不确定，排序保证确定性。合并相邻分区也要求按位置排序
+        std::sort(ranges.begin(), ranges.end());
+    }
+
+    if (partition_fits) {
+        MergeAdjacentPartitions();
+    }
+
+    partition_ids.clear();
+    partition_ids.shrink_to_fit();
+    swapped_with.clear();
+    swapped_with.shrink_to_fit();
+
+    // 更新sorted_to
+    for (uint32 i = 0; i < num_elements; i++) {
+        sorted_to[indices[i]] = i;
+    }
+}
+
+// 分区不超过最大元素数量，并满足额外的限制
+inline bool GraphPartitioner::IsPartitionValid(int32 offset, int32 num) const {
+    if (num > max_partition_size) {
+        return false;
+    }
+    return !partition_fits || partition_fits(indices.data() + offset, static_cast<uint32>(num));
+}
+
+// 额外的限制会把接近最大元素数量的分区再二分一次，得到的两半通常偏小。
+// 相邻的分区来自二分树中相邻的子树，空间上也相邻，合并后仍满足所有限制时就合并
+inline void GraphPartitioner::MergeAdjacentPartitions() {
+    uint32 num_merged = 0;
+    for (uint32 i = 0; i < ranges.size(); i++) {
+        const Range range = ranges[i];
+        if (num_merged > 0) {
+            Range& last = ranges[num_merged - 1];
+            if (IsPartitionValid(last.begin, range.end - last.begin)) {
+                last.end = range.end;
+                continue;
+            }
+        }
+        ranges[num_merged++] = range;
+    }
+    ranges.resize(num_merged);
 }
 
+// 将图二分，若子图仍超过最大分区大小，则输出两个子图继续二分
 inline void GraphPartitioner::BisectGraph(GraphData* graph, GraphData* child_graphs[2]) {
+    child_graphs[0] = nullptr;
+    child_graphs[1] = nullptr;
+
+    auto AddPartition = [this](int32 offset, int32 num) {
+        uint32 range_index = num_parition++;
+        CHECK(range_index < ranges.size());
+        ranges[range_index] = { static_cast<uint32>(offset), static_cast<uint32>(offset + num) };
+    };
+
+    // 图足够小，直接作为一个分区
+    if (IsPartitionValid(graph->offset, graph->num)) {
+        AddPartition(graph->offset, graph->num);
+        return;
+    }
+
+    const int32 target_partition_size = (min_partition_size + max_partition_size) / 2;
+    // 四舍五入计算目标分区数，至少为2
+    const int32 target_num_partitions =
+        std::max(2, (graph->num + target_partition_size / 2) / target_partition_size);
+
+    CHECK(graph->adjacency_offset.size() == graph->num + 1);
+
+    idx_t num_constraints = 1;
+    idx_t num_parts       = 2;
+    idx_t edges_cut       = 0;
+
+    // 两侧的权重按目标分区数的比例分配，使两侧最终都能被均匀地划分
+    real_t partition_weights[] = {
+        float(target_num_partitions / 2) / target_num_partitions,
+        1.0f - float(target_num_partitions / 2) / target_num_partitions
+    };
+
+    idx_t options[METIS_NOPTIONS];
+    METIS_SetDefaultOptions(options);
+
+    // 较高层级允许更宽松的负载均衡，接近分区大小时才需要严格均衡
+    bool loose = target_num_partitions >= 128 || max_partition_size / min_partition_size > 1;
+
+    options[METIS_OPTION_UFACTOR] = loose ? 200 : 1;
+
+    int r = METIS_PartGraphRecursive(
+        &graph->num,
+        &num_constraints,
+        graph->adjacency_offset.data(),
+        graph->adjacency.data(),
+        nullptr,
+        nullptr,
+        graph->adjacency_cost.data(),
+        &num_parts,
+        partition_weights,
+        nullptr,
+        options,
+        &edges_cut,
+        partition_ids.data() + graph->offset
+    );
+
+    if (r != METIS_OK) {
+        throw std::runtime_error("failed to bisect graph");
+    }
+
+    // 原地将数组划分为两部分，两侧仍保持原有的相对顺序
+    int32 front = graph->offset;
+    int32 back  = graph->offset + graph->num - 1;
+    while (front <= back) {
+        while (front <= back && partition_ids[front] == 0) {
+            swapped_with[front] = front;
+            front++;
+        }
+
+        while (front <= back && partition_ids[back] == 1) {
+            swapped_with[back] = back;
+            back--;
+        }
+
+        if (front < back) {
+            std::swap(indices[front], indices[back]);
+
+            swapped_with[front] = back;
+            swapped_with[back]  = front;
+            front++;
+            back--;
+        }
+    }
+
+    int32 split = front;
+
+    int32 num[2];
+    num[0] = split - graph->offset;
+    num[1] = graph->offset + graph->num - split;
+
+    CHECK(num[0] > 1);
+    CHECK(num[1] > 1);
+
+    if (IsPartitionValid(graph->offset, num[0]) && IsPartitionValid(split, num[1])) {
+        AddPartition(graph->offset, num[0]);
+        AddPartition(split, num[1]);
+        return;
+    }
+
+    for (int32 i = 0; i < 2; i++) {
+        child_graphs[i] = new GraphData;
+        child_graphs[i]->adjacency.reserve(graph->adjacency.size() >> 1);
+        child_graphs[i]->adjacency_cost.reserve(graph->adjacency.size() >> 1);
+        child_graphs[i]->adjacency_offset.reserve(num[i] + 1);
+        child_graphs[i]->num = num[i];
+    }
+
+    child_graphs[0]->offset = graph->offset;
+    child_graphs[1]->offset = split;
+
+    // 将父图的邻接关系拆分到两个子图中，跨越两侧的边被丢弃
+    for (int32 i = 0; i < graph->num; i++) {
+        GraphData* child_graph = child_graphs[i >= child_graphs[0]->num ? 1 : 0];
+
+        child_graph->adjacency_offset.push_back(child_graph->adjacency.size());
+
+        int32 org_index = swapped_with[graph->offset + i] - graph->offset;
+        for (idx_t adj_index = graph->adjacency_offset[org_index]; adj_index < graph->adjacency_offset[org_index + 1];
+             adj_index++) {
+            idx_t adj      = graph->adjacency[adj_index];
+            idx_t adj_cost = graph->adjacency_cost[adj_index];
+
+            // 重映射到子图的本地索引
+            adj = swapped_with[graph->offset + adj] - child_graph->offset;
+
+            // 仅保留连接到同一子图内节点的边
+            if (0 <= adj && adj < child_graph->num) {
+                child_graph->adjacency.push_back(adj);
+                child_graph->adjacency_cost.push_back(adj_cost);
+            }
+        }
+    }
+    child_graphs[0]->adjacency_offset.push_back(child_graphs[0]->adjacency.size());
+    child_graphs[1]->adjacency_offset.push_back(child_graphs[1]->adjacency.size());
 }
 
 inline void GraphPartitioner::RecursiveBisectGraph(GraphData* graph) {
+    GraphData* child_graphs[2];
+    BisectGraph(graph, child_graphs);
+    delete graph;
+
+    if (child_graphs[0] && child_graphs[1]) {
+        RecursiveBisectGraph(child_graphs[0]);
+        RecursiveBisectGraph(child_graphs[1]);
+    }
 }
\ No newline at end of file
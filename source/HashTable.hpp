@@ -1,14 +1,88 @@
 #pragma once
 
 #include "Common.hpp"
+#include "Parallel.hpp"
+
+#include <array>
+#include <atomic>
+#include <limits>
+#include <utility>
+
+// 定义为1时记录哈希表查询的探测次数，用于检查哈希函数和桶数量是否合适。
+// 每次查询都有原子操作，只在检测构建中开启
+#ifndef HASH_TABLE_STATS
+#define HASH_TABLE_STATS 0
+#endif
+
+// 哈希表的桶占用和查询统计
+struct HashTableStats {
+    static constexpr uint32 MaxHistogramChain = 15;
+
+    uint32 hash_size   = 0;
+    uint32 num_entries = 0;
+    uint32 max_chain   = 0;
+
+    // 下标为链长，值为桶的个数，最后一项包括所有更长的链
+    std::array<uint32, MaxHistogramChain + 1> chain_histogram {};
+
+    // 只在HASH_TABLE_STATS开启时记录
+    uint64 num_queries = 0;
+    uint64 num_probes  = 0; // 查询时访问的链表节点数
+    uint64 num_matches = 0; // 访问的节点中通过完整比较的数量，其余为哈希冲突
+    uint32 max_probes  = 0; // 单次查询访问的最多节点数
+
+    double GetLoadFactor() const { return hash_size ? double(num_entries) / hash_size : 0.0; }
+    // 非空桶的平均链长
+    double GetAverageChain() const {
+        const uint32 num_used = hash_size - chain_histogram[0];
+        return num_used ? double(num_entries) / num_used : 0.0;
+    }
+    double GetAverageProbes() const { return num_queries ? double(num_probes) / num_queries : 0.0; }
+    double GetFalseHitRate() const { return num_probes ? double(num_probes - num_matches) / num_probes : 0.0; }
+};
+
+#if HASH_TABLE_STATS
+// 查询的探测计数，每次查询结束时累加一次
+struct HashProbeCounters {
+    std::atomic<uint64> num_queries { 0 };
+    std::atomic<uint64> num_probes { 0 };
+    std::atomic<uint64> num_matches { 0 };
+    std::atomic<uint32> max_probes { 0 };
+
+    void Add(uint32 probes, uint32 matches) {
+        num_queries.fetch_add(1, std::memory_order_relaxed);
+        num_probes.fetch_add(probes, std::memory_order_relaxed);
+        num_matches.fetch_add(matches, std::memory_order_relaxed);
+
+        uint32 max = max_probes.load(std::memory_order_relaxed);
+        while (probes > max && !max_probes.compare_exchange_weak(max, probes, std::memory_order_relaxed)) {}
+    }
 
-class HashTable {
+    void Fill(HashTableStats& stats) const {
+        stats.num_queries = num_queries.load(std::memory_order_relaxed);
+        stats.num_probes  = num_probes.load(std::memory_order_relaxed);
+        stats.num_matches = num_matches.load(std::memory_order_relaxed);
+        stats.max_probes  = max_probes.load(std::memory_order_relaxed);
+    }
+};
+#endif
+
+// 索引使用IndexType存储，索引数量小于65535时使用uint16可以减半哈希表的内存。
+// 接口中的索引统一为uint32，空索引为~0u
+template<typename IndexType>
+class BasicHashTable {
 public:
-    HashTable(uint32 hash_size = 1024, uint32 index_size = 0);
-    HashTable(const HashTable& other);
-    HashTable(HashTable&& other) noexcept;
-    HashTable& operator=(const HashTable& other);
-    HashTable& operator=(HashTable&& other) noexcept;
+    static_assert(std::is_unsigned_v<IndexType>, "BasicHashTable only supports unsigned index types");
+
+    // 存储中表示空索引的值，可以存储的索引必须小于它
+    static constexpr IndexType InvalidIndex = static_cast<IndexType>(~IndexType(0));
+
+    BasicHashTable(uint32 hash_size = 1024, uint32 index_size = 0);
+    BasicHashTable(const BasicHashTable& other);
+    BasicHashTable(BasicHashTable&& other) noexcept;
+    ~BasicHashTable() { Free(); }
+    BasicHashTable& operator=(const BasicHashTable& other);
+    BasicHashTable& operator=(BasicHashTable&& other) noexcept;
 
     void Clear() const;
     void Free();
@@ -18,10 +92,17 @@ public:
     uint32 IndexSize() const { return m_index_size; }
     uint32 HashSize() const { return m_hash_size; }
 
+    size_t GetAllocatedSize() const {
+        return m_index_size ? (size_t(m_hash_size) + m_index_size) * sizeof(IndexType) : 0;
+    }
+
     uint32 First(uint32 key) const;
     uint32 Next(uint32 index) const;
     bool   IsValid(uint32 index) const;
 
+    // 统计每个桶的链长，不包括查询统计
+    void ComputeStats(HashTableStats& stats) const;
+
     void Add(uint32 key, uint32 index);
     void AddConcurrent(uint32 key, uint32 index) const;
     void Remove(uint32 key, uint32 index) const;
@@ -31,15 +112,23 @@ protected:
     uint32 m_hash_mask;
     uint32 m_index_size;
 
-    uint32* m_head_buckets; // 哈希数组中存储每个桶的链表头节点索引
-    uint32* m_next_indices; // 存储从index可以达到的下一个索引
+    IndexType* m_head_buckets; // 哈希数组中存储每个桶的链表头节点索引
+    IndexType* m_next_indices; // 存储从index可以达到的下一个索引
 
-    static uint32 EmptyHash[1];
+    // 将存储的索引转换为接口中的索引
+    static uint32 ToIndex(IndexType index) { return index == InvalidIndex ? ~0u : index; }
+
+    static IndexType EmptyHash[1];
 };
 
-inline uint32 HashTable::EmptyHash[1] = { ~0u };
+using HashTable   = BasicHashTable<uint32>;
+using HashTable16 = BasicHashTable<uint16>;
+
+template<typename IndexType>
+inline IndexType BasicHashTable<IndexType>::EmptyHash[1] = { InvalidIndex };
 
-inline HashTable::HashTable(uint32 hash_size, uint32 index_size):
+template<typename IndexType>
+inline BasicHashTable<IndexType>::BasicHashTable(uint32 hash_size, uint32 index_size):
     m_hash_size(hash_size),
     m_hash_mask(0),
     m_index_size(index_size),
@@ -53,30 +142,32 @@ inline HashTable::HashTable(uint32 hash_size, uint32 index_size):
     if (m_index_size) {
         m_hash_mask = m_hash_size - 1;
         // 分配哈希桶的头索引和链表
-        m_head_buckets = new uint32[m_index_size];
-        m_next_indices = new uint32[m_index_size];
+        m_head_buckets = new IndexType[m_hash_size];
+        m_next_indices = new IndexType[m_index_size];
         // 初始化数组元素为0xff
-        std::memset(m_head_buckets, 0xff, m_hash_size * sizeof(uint32));
+        std::memset(m_head_buckets, 0xff, m_hash_size * sizeof(IndexType));
     }
 }
 
-inline HashTable::HashTable(const HashTable& other):
+template<typename IndexType>
+inline BasicHashTable<IndexType>::BasicHashTable(const BasicHashTable& other):
     m_hash_size(other.m_hash_size),
     m_hash_mask(other.m_hash_mask),
     m_index_size(other.m_index_size),
     m_head_buckets(EmptyHash), // 让未初始化或已释放的哈希表也能安全响应
     m_next_indices(nullptr) {
     if (m_index_size) {
-        m_head_buckets = new uint32[m_hash_size];
-        m_next_indices = new uint32[m_index_size];
+        m_head_buckets = new IndexType[m_hash_size];
+        m_next_indices = new IndexType[m_index_size];
 
         // 拷贝内存
-        std::memcpy(m_head_buckets, other.m_head_buckets, m_hash_size * sizeof(uint32));
-        std::memcpy(m_next_indices, other.m_next_indices, m_index_size * sizeof(uint32));
+        std::memcpy(m_head_buckets, other.m_head_buckets, m_hash_size * sizeof(IndexType));
+        std::memcpy(m_next_indices, other.m_next_indices, m_index_size * sizeof(IndexType));
     }
 }
 
-inline HashTable::HashTable(HashTable&& other) noexcept:
+template<typename IndexType>
+inline BasicHashTable<IndexType>::BasicHashTable(BasicHashTable&& other) noexcept:
     m_hash_size(other.m_hash_size),
     m_hash_mask(other.m_hash_mask),
     m_index_size(other.m_index_size),
@@ -86,10 +177,11 @@ inline HashTable::HashTable(HashTable&& other) noexcept:
     other.m_hash_mask    = 0;
     other.m_index_size   = 0;
     other.m_head_buckets = EmptyHash;
-    other.m_next_indices = m_next_indices;
+    other.m_next_indices = nullptr;
 }
 
-inline HashTable& HashTable::operator=(const HashTable& other) {
+template<typename IndexType>
+inline BasicHashTable<IndexType>& BasicHashTable<IndexType>::operator=(const BasicHashTable& other) {
     if (this == &other) { // 显式处理自赋值
         return *this;
     }
@@ -103,18 +195,25 @@ inline HashTable& HashTable::operator=(const HashTable& other) {
     m_next_indices = nullptr;
 
     if (m_index_size) {
-        m_head_buckets = new uint32[m_hash_size];
-        m_next_indices = new uint32[m_index_size];
+        m_head_buckets = new IndexType[m_hash_size];
+        m_next_indices = new IndexType[m_index_size];
 
         // 拷贝内存
-        std::memcpy(m_head_buckets, other.m_head_buckets, m_hash_size * sizeof(uint32));
-        std::memcpy(m_next_indices, other.m_next_indices, m_index_size * sizeof(uint32));
+        std::memcpy(m_head_buckets, other.m_head_buckets, m_hash_size * sizeof(IndexType));
+        std::memcpy(m_next_indices, other.m_next_indices, m_index_size * sizeof(IndexType));
     }
 
     return *this;
 }
 
-inline HashTable& HashTable::operator=(HashTable&& other) noexcept {
+template<typename IndexType>
+inline BasicHashTable<IndexType>& BasicHashTable<IndexType>::operator=(BasicHashTable&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+
+    Free();
+
     m_hash_size    = other.m_hash_size;
     m_hash_mask    = other.m_hash_mask;
     m_index_size   = other.m_index_size;
@@ -125,18 +224,20 @@ inline HashTable& HashTable::operator=(HashTable&& other) noexcept {
     other.m_hash_mask    = 0;
     other.m_index_size   = 0;
     other.m_head_buckets = EmptyHash;
-    other.m_next_indices = m_next_indices;
+    other.m_next_indices = nullptr;
     return *this;
 }
 
-inline void HashTable::Clear() const {
+template<typename IndexType>
+inline void BasicHashTable<IndexType>::Clear() const {
     // 切断从桶到链表的访问入口
     if (m_index_size) {
-        std::memset(m_head_buckets, 0xff, m_hash_size * sizeof(uint32));
+        std::memset(m_head_buckets, 0xff, m_hash_size * sizeof(IndexType));
     }
 }
 
-inline void HashTable::Free() {
+template<typename IndexType>
+inline void BasicHashTable<IndexType>::Free() {
     if (m_index_size) {
         m_hash_mask  = 0;
         m_index_size = 0;
@@ -149,13 +250,14 @@ inline void HashTable::Free() {
     }
 }
 
-inline void HashTable::Resize(uint32 new_index_size) {
+template<typename IndexType>
+inline void BasicHashTable<IndexType>::Resize(uint32 new_index_size) {
     if (new_index_size == m_index_size) return;
     if (new_index_size == 0 || m_index_size == 0) return;
 
-    uint32* new_nex_index = new uint32[new_index_size];
+    IndexType* new_nex_index = new IndexType[new_index_size];
     if (m_next_indices) {
-        std::memcpy(new_nex_index, m_next_indices, m_index_size * sizeof(uint32));
+        std::memcpy(new_nex_index, m_next_indices, m_index_size * sizeof(IndexType));
         delete[] m_next_indices;
     }
 
@@ -164,25 +266,49 @@ inline void HashTable::Resize(uint32 new_index_size) {
 }
 
 // 返回key对应的链表的第一个索引
-inline uint32 HashTable::First(uint32 key) const {
+template<typename IndexType>
+inline uint32 BasicHashTable<IndexType>::First(uint32 key) const {
     key &= m_hash_mask;
-    return m_head_buckets[key];
+    return ToIndex(m_head_buckets[key]);
 }
 
 // 返回链表当前索引后的下一个索引
-inline uint32 HashTable::Next(uint32 index) const {
+template<typename IndexType>
+inline uint32 BasicHashTable<IndexType>::Next(uint32 index) const {
     CHECK(index < m_index_size);
     // 避免链表节点自引用导致的无限循环
     CHECK(m_next_indices[index] != index);
-    return m_next_indices[index];
+    return ToIndex(m_next_indices[index]);
 }
 
-inline bool HashTable::IsValid(uint32 index) const {
+template<typename IndexType>
+inline bool BasicHashTable<IndexType>::IsValid(uint32 index) const {
     return index != ~0u;
 }
 
+template<typename IndexType>
+inline void BasicHashTable<IndexType>::ComputeStats(HashTableStats& stats) const {
+    stats.hash_size   = m_index_size ? m_hash_size : 0;
+    stats.num_entries = 0;
+    stats.max_chain   = 0;
+    stats.chain_histogram.fill(0);
+
+    for (uint32 key = 0; key < stats.hash_size; key++) {
+        uint32 chain = 0;
+        for (uint32 i = ToIndex(m_head_buckets[key]); IsValid(i); i = ToIndex(m_next_indices[i])) {
+            chain++;
+        }
+        stats.num_entries += chain;
+        stats.max_chain = std::max(stats.max_chain, chain);
+        stats.chain_histogram[std::min(chain, HashTableStats::MaxHistogramChain)]++;
+    }
+}
+
 // key决定元素放入哪个桶，index决定数据在外部数组中的索引位置，HashTable本身不存储数据，只存储索引
-inline void HashTable::Add(uint32 key, uint32 index) {
+template<typename IndexType>
+inline void BasicHashTable<IndexType>::Add(uint32 key, uint32 index) {
+    CHECK(index < InvalidIndex);
+
     // 如果提供的索引超出当前哈希表容量，动态扩容
     if (index >= m_index_size) {
         // 新容量取32和(index+1)向上取整到2的幂中的较大值
@@ -196,21 +322,23 @@ inline void HashTable::Add(uint32 key, uint32 index) {
     // m_Hash[key]存储的是头节点的索引
     m_next_indices[index] = m_head_buckets[key];
     // 更新链表头为新添加的元素，从m_Hash[key]可以访问到整个链表上的所有元素:
-    m_head_buckets[key] = index;
+    m_head_buckets[key] = static_cast<IndexType>(index);
 }
 
-inline void HashTable::AddConcurrent(uint32 key, uint32 index) const {
-    CHECK(index < m_index_size);
+template<typename IndexType>
+inline void BasicHashTable<IndexType>::AddConcurrent(uint32 key, uint32 index) const {
+    CHECK(index < m_index_size && index < InvalidIndex);
 
     key &= m_hash_mask;
     // 使用原子交换操作实现线程安全的头插法
     m_next_indices[index] = std::atomic_exchange( // 将一个原子对象的值替换为新值并返回替换前的旧值
-        reinterpret_cast<std::atomic<uint32>*>(&m_head_buckets[key]), // 将m_Hash[key]视为原子变量
-        index // 原子地读取m_Hash[key]的当前值，并将其替换为新的index
+        reinterpret_cast<std::atomic<IndexType>*>(&m_head_buckets[key]), // 将m_Hash[key]视为原子变量
+        static_cast<IndexType>(index) // 原子地读取m_Hash[key]的当前值，并将其替换为新的index
     ); // 将原始值设置为新元素的next指针
 }
 
-inline void HashTable::Remove(uint32 key, uint32 index) const {
+template<typename IndexType>
+inline void BasicHashTable<IndexType>::Remove(uint32 key, uint32 index) const {
     if (index >= m_index_size) {
         return;
     }
@@ -225,11 +353,179 @@ inline void HashTable::Remove(uint32 key, uint32 index) const {
     }
 
     // 从头节点开始遍历
-    for (uint32 i = m_head_buckets[key]; IsValid(i); i = m_next_indices[i]) {
+    for (uint32 i = ToIndex(m_head_buckets[key]); IsValid(i); i = ToIndex(m_next_indices[i])) {
         if (m_next_indices[i] == index) // 找到该节点
         {
             m_next_indices[i] = m_next_indices[index]; // 指向下下一个节点即可
             break;
         }
     }
-}
\ No newline at end of file
+}
+
+// 一次构建、之后只读的哈希表。先统计每个桶的元素数，求前缀和后把元素分发到一个连续数组中，
+// 每个桶是数组中连续的一段，同时保存完整的key。查询时顺序扫描这一段，不需要沿链表跳转
+template<typename IndexType>
+class BasicStaticHashTable {
+public:
+    static_assert(std::is_unsigned_v<IndexType>, "BasicStaticHashTable only supports unsigned index types");
+
+    // 为[0, num)的索引建立哈希表，GetKey返回每个索引的key，可以并发调用。
+    // 同一个桶内的元素按索引升序排列，结果与线程数无关
+    template<typename FuncType>
+        requires std::invocable<FuncType, uint32> && std::same_as<std::invoke_result_t<FuncType, uint32>, uint32>
+    void Build(uint32 hash_size, uint32 num, FuncType&& GetKey);
+
+    void Free();
+
+    uint32 HashSize() const { return m_hash_mask + (m_bucket_starts.empty() ? 0 : 1); }
+    uint32 Size() const { return static_cast<uint32>(m_indices.size()); }
+
+    size_t GetAllocatedSize() const {
+        const size_t num_uint32 = m_bucket_starts.capacity() + m_keys.capacity();
+        return num_uint32 * sizeof(uint32) + m_indices.capacity() * sizeof(IndexType);
+    }
+
+    // 对key完全相同的每个索引调用Function，返回扫描的桶内元素数
+    template<typename FuncType>
+    uint32 ForAll(uint32 key, FuncType&& Function) const;
+
+    void ComputeStats(HashTableStats& stats) const;
+
+private:
+    uint32 m_hash_mask = 0;
+
+    FirstTouchVector<uint32>    m_bucket_starts; // 每个桶的起始位置，最后一个元素为元素总数
+    FirstTouchVector<uint32>    m_keys; // 按桶排列的key
+    FirstTouchVector<IndexType> m_indices; // 按桶排列的索引
+};
+
+using StaticHashTable   = BasicStaticHashTable<uint32>;
+using StaticHashTable16 = BasicStaticHashTable<uint16>;
+
+template<typename IndexType>
+template<typename FuncType>
+    requires std::invocable<FuncType, uint32> && std::same_as<std::invoke_result_t<FuncType, uint32>, uint32>
+inline void BasicStaticHashTable<IndexType>::Build(uint32 hash_size, uint32 num, FuncType&& GetKey) {
+    CHECK(std::has_single_bit(hash_size));
+    CHECK(num == 0 || num - 1 <= std::numeric_limits<IndexType>::max());
+
+    // 分两趟稳定的计数排序：先按桶的高位分到若干段，每段对应一组连续的桶，再在段内按桶分发。
+    // 第二趟每段只访问自己的一小块桶数组，不需要原子操作
+    constexpr uint32 MaxNumParts = 1024;
+    constexpr uint32 ChunkSize   = 1u << 16;
+
+    const uint32 num_parts        = std::min(hash_size, MaxNumParts);
+    const uint32 part_shift       = std::countr_zero(hash_size) - std::countr_zero(num_parts);
+    const uint32 buckets_per_part = hash_size / num_parts;
+    const uint32 num_chunks       = DivideAndRoundUp(num, ChunkSize);
+
+    m_hash_mask = hash_size - 1;
+
+    // 每个块分别统计各段的元素数
+    FirstTouchVector<uint32> keys(num);
+    std::vector<uint32>      part_offsets(size_t(num_chunks) * num_parts);
+    ParallelFor("StaticHashTable.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+        uint32*      counts = part_offsets.data() + chunk * num_parts;
+        const uint32 begin  = static_cast<uint32>(chunk) * ChunkSize;
+        const uint32 end    = std::min(begin + ChunkSize, num);
+        std::fill(counts, counts + num_parts, 0u);
+        for (uint32 index = begin; index < end; index++) {
+            keys[index] = GetKey(index);
+            counts[(keys[index] & m_hash_mask) >> part_shift]++;
+        }
+    });
+
+    // 按段优先、块次之的顺序求前缀和，同一段内前面的块先放，段内保持索引的顺序
+    std::vector<uint32> part_starts(num_parts + 1);
+    uint32              offset = 0;
+    for (uint32 part = 0; part < num_parts; part++) {
+        part_starts[part] = offset;
+        for (uint32 chunk = 0; chunk < num_chunks; chunk++) {
+            uint32& count = part_offsets[size_t(chunk) * num_parts + part];
+            offset += std::exchange(count, offset);
+        }
+    }
+    part_starts[num_parts] = offset;
+
+    FirstTouchVector<uint32> part_keys(num);
+    FirstTouchVector<uint32> part_indices(num);
+    ParallelFor("StaticHashTable.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+        uint32*      offsets = part_offsets.data() + chunk * num_parts;
+        const uint32 begin   = static_cast<uint32>(chunk) * ChunkSize;
+        const uint32 end     = std::min(begin + ChunkSize, num);
+        for (uint32 index = begin; index < end; index++) {
+            const uint32 dst  = offsets[(keys[index] & m_hash_mask) >> part_shift]++;
+            part_keys[dst]    = keys[index];
+            part_indices[dst] = index;
+        }
+    });
+    FirstTouchVector<uint32>().swap(keys);
+    std::vector<uint32>().swap(part_offsets);
+
+    // 段内按桶计数排序，写出每个桶的起始位置
+    m_bucket_starts.resize(size_t(hash_size) + 1);
+    m_keys.resize(num);
+    m_indices.resize(num);
+    ParallelFor("StaticHashTable.ParallelFor", num_parts, 1, [&](size_t part) {
+        const uint32 first_bucket = static_cast<uint32>(part) * buckets_per_part;
+
+        thread_local std::vector<uint32> offsets;
+        offsets.assign(buckets_per_part, 0);
+        for (uint32 i = part_starts[part]; i < part_starts[part + 1]; i++) {
+            offsets[(part_keys[i] & m_hash_mask) - first_bucket]++;
+        }
+
+        uint32 bucket_offset = part_starts[part];
+        for (uint32 bucket = 0; bucket < buckets_per_part; bucket++) {
+            m_bucket_starts[first_bucket + bucket] = bucket_offset;
+            bucket_offset += std::exchange(offsets[bucket], bucket_offset);
+        }
+
+        for (uint32 i = part_starts[part]; i < part_starts[part + 1]; i++) {
+            const uint32 dst = offsets[(part_keys[i] & m_hash_mask) - first_bucket]++;
+            m_keys[dst]      = part_keys[i];
+            m_indices[dst]   = static_cast<IndexType>(part_indices[i]);
+        }
+    });
+    m_bucket_starts[hash_size] = num;
+}
+
+template<typename IndexType>
+inline void BasicStaticHashTable<IndexType>::Free() {
+    m_hash_mask = 0;
+    FirstTouchVector<uint32>().swap(m_bucket_starts);
+    FirstTouchVector<uint32>().swap(m_keys);
+    FirstTouchVector<IndexType>().swap(m_indices);
+}
+
+template<typename IndexType>
+template<typename FuncType>
+inline uint32 BasicStaticHashTable<IndexType>::ForAll(uint32 key, FuncType&& Function) const {
+    if (m_bucket_starts.empty()) {
+        return 0;
+    }
+
+    const uint32 bucket = key & m_hash_mask;
+    const uint32 begin  = m_bucket_starts[bucket];
+    const uint32 end    = m_bucket_starts[bucket + 1];
+    for (uint32 i = begin; i < end; i++) {
+        if (m_keys[i] == key) {
+            Function(static_cast<uint32>(m_indices[i]));
+        }
+    }
+    return end - begin;
+}
+
+template<typename IndexType>
+inline void BasicStaticHashTable<IndexType>::ComputeStats(HashTableStats& stats) const {
+    stats.hash_size   = HashSize();
+    stats.num_entries = Size();
+    stats.max_chain   = 0;
+    stats.chain_histogram.fill(0);
+
+    for (uint32 bucket = 0; bucket < stats.hash_size; bucket++) {
+        const uint32 chain = m_bucket_starts[bucket + 1] - m_bucket_starts[bucket];
+        stats.max_chain    = std::max(stats.max_chain, chain);
+        stats.chain_histogram[std::min(chain, HashTableStats::MaxHistogramChain)]++;
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Common.hpp"
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// 只读的内存映射文件，文件内容按需由操作系统分页载入
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path);
+    void Close();
+
+    bool         IsValid() const { return m_data != nullptr; }
+    const uint8* Data() const { return m_data; }
+    size_t       Size() const { return m_size; }
+
+private:
+#if defined(_WIN32)
+    HANDLE m_file    = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+
+    const uint8* m_data = nullptr;
+    size_t       m_size = 0;
+};
+
+inline bool MappedFile::Open(const std::string& path) {
+    Close();
+
+#if defined(_WIN32)
+    m_file = CreateFileA(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (m_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    m_size = static_cast<size_t>(file_size.QuadPart);
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping) {
+        Close();
+        return false;
+    }
+
+    m_data = static_cast<const uint8*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    m_file = open(path.c_str(), O_RDONLY);
+    if (m_file < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(m_file, &file_stat) != 0 || file_stat.st_size == 0) {
+        Close();
+        return false;
+    }
+    m_size = static_cast<size_t>(file_stat.st_size);
+
+    void* address = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+    m_data        = address == MAP_FAILED ? nullptr : static_cast<const uint8*>(address);
+#endif
+
+    if (!m_data) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+inline void MappedFile::Close() {
+#if defined(_WIN32)
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_data) {
+        munmap(const_cast<uint8*>(m_data), m_size);
+    }
+    if (m_file >= 0) {
+        close(m_file);
+        m_file = -1;
+    }
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
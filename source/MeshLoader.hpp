@@ -1,5 +1,84 @@
 #pragma once
 
-#include "tinyobjloader/tiny_obj_loader.hpp"
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "Math/BoundingBox.hpp"
 
-class MeshLoader {};
\ No newline at end of file
+#include "tinyobjloader/tiny_obj_loader.h"
+
+// 构建cluster所需的网格数据
+struct MeshData {
+    MeshBuildVertexView verts;
+    std::vector<uint32> indices;
+    std::vector<int32>  material_indexes;
+    Bounds3f            bounds;
+
+    uint32 NumTriangles() const { return static_cast<uint32>(indices.size() / 3); }
+};
+
+class MeshLoader {
+public:
+    // 加载obj网格，面会被三角化，失败时返回false并可通过GetError获取原因
+    bool Load(const std::string& path, MeshData& mesh);
+
+    const std::string& GetError() const { return m_error; }
+
+private:
+    std::string m_error;
+};
+
+inline bool MeshLoader::Load(const std::string& path, MeshData& mesh) {
+    tinyobj::ObjReaderConfig config;
+    config.triangulate = true;
+
+    tinyobj::ObjReader reader;
+    if (!reader.ParseFromFile(path, config)) {
+        m_error = reader.Error().empty() ? "failed to load " + path : reader.Error();
+        return false;
+    }
+
+    const tinyobj::attrib_t&             attrib = reader.GetAttrib();
+    const std::vector<tinyobj::shape_t>& shapes = reader.GetShapes();
+
+    // 只使用位置，顶点直接对应obj中的位置索引
+    const size_t num_positions = attrib.vertices.size() / 3;
+    mesh.verts.Positions.resize(num_positions);
+    mesh.bounds = Bounds3f();
+    for (size_t i = 0; i < num_positions; i++) {
+        Point3f position(attrib.vertices[i * 3 + 0], attrib.vertices[i * 3 + 1], attrib.vertices[i * 3 + 2]);
+        mesh.verts.Positions[i] = position;
+        mesh.bounds.AddPoint(position);
+    }
+
+    size_t num_indices = 0;
+    for (const auto& shape: shapes) {
+        num_indices += shape.mesh.indices.size();
+    }
+
+    mesh.indices.clear();
+    mesh.indices.reserve(num_indices);
+    mesh.material_indexes.clear();
+    mesh.material_indexes.reserve(num_indices / 3);
+
+    bool has_materials = !reader.GetMaterials().empty();
+    for (const auto& shape: shapes) {
+        for (const auto& index: shape.mesh.indices) {
+            if (index.vertex_index < 0 || static_cast<size_t>(index.vertex_index) >= num_positions) {
+                m_error = "invalid vertex index in " + path;
+                return false;
+            }
+            mesh.indices.push_back(static_cast<uint32>(index.vertex_index));
+        }
+
+        if (has_materials) {
+            mesh.material_indexes.insert(
+                mesh.material_indexes.end(),
+                shape.mesh.material_ids.begin(),
+                shape.mesh.material_ids.end()
+            );
+        }
+    }
+
+    m_error.clear();
+    return true;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Common.hpp"
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+    #include <fstream>
+#endif
+
+// 机器的NUMA节点和每个节点上的逻辑处理器，无法获取时视为只有一个节点且不绑定线程。
+// Windows上处理器编号为组号 * 64 + 组内编号
+class NumaTopology {
+public:
+    static const NumaTopology& Get();
+
+    uint32 NumNodes() const { return std::max<uint32>(1, static_cast<uint32>(m_node_processors.size())); }
+
+    const std::vector<uint32>& GetProcessors(uint32 node) const { return m_node_processors[node]; }
+
+    // 将当前线程绑定到node上的所有处理器，失败时返回false
+    bool PinCurrentThread(uint32 node) const;
+
+private:
+    NumaTopology();
+
+    std::vector<std::vector<uint32>> m_node_processors; // 只包括有处理器的节点
+};
+
+inline const NumaTopology& NumaTopology::Get() {
+    static NumaTopology topology;
+    return topology;
+}
+
+inline NumaTopology::NumaTopology() {
+#if defined(_WIN32)
+    ULONG highest_node = 0;
+    if (!GetNumaHighestNodeNumber(&highest_node)) {
+        return;
+    }
+
+    for (ULONG node = 0; node <= highest_node; node++) {
+        GROUP_AFFINITY affinity {};
+        if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) || affinity.Mask == 0) {
+            continue;
+        }
+
+        std::vector<uint32> processors;
+        for (uint32 bit = 0; bit < 64; bit++) {
+            if (affinity.Mask & (KAFFINITY(1) << bit)) {
+                processors.push_back(uint32(affinity.Group) * 64 + bit);
+            }
+        }
+        m_node_processors.push_back(std::move(processors));
+    }
+#elif defined(__linux__)
+    // 节点编号可能不连续，只有内存没有处理器的节点也会出现在这里
+    for (uint32 node = 0; node < 1024; node++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) {
+            continue;
+        }
+
+        // 格式为"0-3,8-11"
+        std::string         list;
+        std::vector<uint32> processors;
+        std::getline(file, list);
+        for (size_t pos = 0; pos < list.size();) {
+            char*        end   = nullptr;
+            const uint32 first = static_cast<uint32>(std::strtoul(list.c_str() + pos, &end, 10));
+            uint32       last  = first;
+            if (*end == '-') {
+                last = static_cast<uint32>(std::strtoul(end + 1, &end, 10));
+            }
+            for (uint32 processor = first; processor <= last; processor++) {
+                processors.push_back(processor);
+            }
+            pos = end - list.c_str() + (*end == ',' ? 1 : list.size());
+        }
+
+        if (!processors.empty()) {
+            m_node_processors.push_back(std::move(processors));
+        }
+    }
+#endif
+}
+
+inline bool NumaTopology::PinCurrentThread(uint32 node) const {
+    if (node >= m_node_processors.size()) {
+        return false;
+    }
+    const std::vector<uint32>& processors = m_node_processors[node];
+
+#if defined(_WIN32)
+    // 一个节点的处理器位于同一个处理器组中
+    GROUP_AFFINITY affinity {};
+    affinity.Group = static_cast<WORD>(processors[0] / 64);
+    for (uint32 processor: processors) {
+        affinity.Mask |= KAFFINITY(1) << (processor % 64);
+    }
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32 processor: processors) {
+        CPU_SET(processor, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
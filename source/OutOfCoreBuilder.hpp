@@ -0,0 +1,557 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Parallel.hpp"
+#include "EdgeHash.hpp"
+#include "MeshLoader.hpp"
+#include "ClusterBuilder.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <unordered_set>
+
+// 可以多次顺序遍历的三角形来源，外存构建只会按顺序读取三角形，不要求整个网格常驻内存
+class TriangleStream {
+public:
+    using TriangleFunction = std::function<void(const Point3f (&positions)[3], int32 material_index)>;
+
+    virtual ~TriangleStream() = default;
+
+    // 第一次调用时可能需要遍历整个来源，之后HasMaterials才有效
+    virtual bool GetBounds(Bounds3f& bounds) = 0;
+    virtual bool HasMaterials() const        = 0;
+
+    // 按顺序遍历所有三角形，失败时返回false并可通过GetError获取原因
+    virtual bool ForEachTriangle(const TriangleFunction& Function) = 0;
+
+    const std::string& GetError() const { return m_error; }
+
+protected:
+    std::string m_error;
+};
+
+// 内存中已有的网格
+class MeshTriangleStream: public TriangleStream {
+public:
+    explicit MeshTriangleStream(const MeshData& mesh): m_mesh(mesh) {}
+
+    bool GetBounds(Bounds3f& bounds) override {
+        bounds = m_mesh.bounds;
+        return true;
+    }
+
+    bool HasMaterials() const override { return !m_mesh.material_indexes.empty(); }
+
+    bool ForEachTriangle(const TriangleFunction& Function) override {
+        for (uint32 tri_index = 0; tri_index < m_mesh.NumTriangles(); tri_index++) {
+            const Point3f positions[3] = {
+                m_mesh.verts.Positions[m_mesh.indices[tri_index * 3 + 0]],
+                m_mesh.verts.Positions[m_mesh.indices[tri_index * 3 + 1]],
+                m_mesh.verts.Positions[m_mesh.indices[tri_index * 3 + 2]],
+            };
+            Function(positions, HasMaterials() ? m_mesh.material_indexes[tri_index] : -1);
+        }
+        return true;
+    }
+
+private:
+    const MeshData& m_mesh;
+};
+
+// 流式读取obj文件，只有顶点位置常驻内存，面在每次遍历时从文件中重新读取。
+// 材质按usemtl名称首次出现的顺序编号，第一个usemtl之前的面材质为-1
+class ObjTriangleStream: public TriangleStream {
+public:
+    explicit ObjTriangleStream(std::filesystem::path path): m_path(std::move(path)) {}
+
+    bool GetBounds(Bounds3f& bounds) override;
+    bool HasMaterials() const override { return !m_materials.empty(); }
+    bool ForEachTriangle(const TriangleFunction& Function) override;
+
+private:
+    bool LoadPositions();
+
+    std::filesystem::path                  m_path;
+    bool                                   m_loaded = false;
+    std::vector<Point3f>                   m_positions;
+    std::unordered_map<std::string, int32> m_materials;
+    Bounds3f                               m_bounds;
+};
+
+// 去掉obj关键字后面的名称首尾的空白
+inline static std::string TrimObjName(const char* text) {
+    std::string name = text;
+    name.erase(0, name.find_first_not_of(" \t"));
+    name.erase(name.find_last_not_of(" \t\r") + 1);
+    return name;
+}
+
+inline bool ObjTriangleStream::LoadPositions() {
+    if (m_loaded) {
+        return true;
+    }
+
+    std::ifstream file(m_path);
+    if (!file) {
+        m_error = "failed to open " + m_path.string();
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        const char* text = line.c_str();
+        if (text[0] == 'v' && (text[1] == ' ' || text[1] == '\t')) {
+            char*   end = nullptr;
+            Point3f position;
+            position.x = std::strtof(text + 2, &end);
+            position.y = std::strtof(end, &end);
+            position.z = std::strtof(end, &end);
+            m_positions.push_back(position);
+            m_bounds.AddPoint(position);
+        } else if (line.rfind("usemtl", 0) == 0) {
+            m_materials.emplace(TrimObjName(text + 6), static_cast<int32>(m_materials.size()));
+        }
+    }
+
+    m_loaded = true;
+    return true;
+}
+
+inline bool ObjTriangleStream::GetBounds(Bounds3f& bounds) {
+    if (!LoadPositions()) {
+        return false;
+    }
+    bounds = m_bounds;
+    return true;
+}
+
+inline bool ObjTriangleStream::ForEachTriangle(const TriangleFunction& Function) {
+    if (!LoadPositions()) {
+        return false;
+    }
+
+    std::ifstream file(m_path);
+    if (!file) {
+        m_error = "failed to open " + m_path.string();
+        return false;
+    }
+
+    int64  num_positions  = 0; // 负数索引相对于当前行之前读到的顶点数
+    int32  material_index = -1;
+    uint32 face[64];
+
+    std::string line;
+    while (std::getline(file, line)) {
+        const char* text = line.c_str();
+        if (text[0] == 'v' && (text[1] == ' ' || text[1] == '\t')) {
+            num_positions++;
+        } else if (line.rfind("usemtl", 0) == 0) {
+            material_index = m_materials[TrimObjName(text + 6)];
+        } else if (text[0] == 'f' && (text[1] == ' ' || text[1] == '\t')) {
+            // 每个顶点的格式为v、v/vt、v//vn或v/vt/vn，只使用位置索引
+            uint32      num_face_verts = 0;
+            const char* cursor         = text + 2;
+            while (true) {
+                char* end   = nullptr;
+                int64 index = std::strtoll(cursor, &end, 10);
+                if (end == cursor) {
+                    break;
+                }
+
+                index = index < 0 ? num_positions + index : index - 1;
+                if (index < 0 || index >= static_cast<int64>(m_positions.size()) || num_face_verts == 64) {
+                    m_error = "invalid face in " + m_path.string();
+                    return false;
+                }
+                face[num_face_verts++] = static_cast<uint32>(index);
+
+                cursor = end;
+                while (*cursor && *cursor != ' ' && *cursor != '\t') {
+                    cursor++;
+                }
+            }
+
+            // 多边形按扇形三角化
+            for (uint32 i = 2; i < num_face_verts; i++) {
+                const Point3f positions[3] = { m_positions[face[0]], m_positions[face[i - 1]], m_positions[face[i]] };
+                Function(positions, material_index);
+            }
+        }
+    }
+
+    return true;
+}
+
+struct OutOfCoreSettings {
+    ClusterBuildSettings  cluster_settings;
+    std::filesystem::path spill_directory; // 分块临时文件所在目录，构建结束后删除
+
+    // 每个分块的三角形上限，决定了构建时的内存峰值
+    uint32 max_chunk_triangles = 1u << 22;
+    // 同时在内存中构建的分块数
+    uint32 max_concurrent_chunks = 2;
+};
+
+struct OutOfCoreResult {
+    uint32 num_triangles      = 0;
+    uint32 num_chunks         = 0;
+    uint32 num_clusters       = 0;
+    uint32 num_seam_triangles = 0;
+};
+
+// 接收构建完成的cluster，chunk_index为分块编号，接缝区域的编号为num_chunks，多个分块的调用不会同时发生
+using ClusterSink = std::function<void(uint32 chunk_index, std::vector<Cluster>& clusters)>;
+
+// 写入临时文件的三角形
+struct OutOfCoreTriangle {
+    Point3f positions[3];
+    int32   material_index;
+};
+static_assert(std::is_trivially_copyable_v<OutOfCoreTriangle>);
+
+// 为每个分块缓存一批三角形，缓存满时追加到分块文件末尾，同时打开的文件数不随分块数增长
+class ChunkSpillWriter {
+public:
+    ChunkSpillWriter(std::vector<std::filesystem::path> paths): m_paths(std::move(paths)), m_buffers(m_paths.size()) {}
+
+    void Add(uint32 chunk_index, const OutOfCoreTriangle& triangle) {
+        m_buffers[chunk_index].push_back(triangle);
+        if (m_buffers[chunk_index].size() >= BufferSize) {
+            Flush(chunk_index);
+        }
+    }
+
+    void Flush(uint32 chunk_index) {
+        auto& buffer = m_buffers[chunk_index];
+        if (buffer.empty()) {
+            return;
+        }
+
+        std::ofstream out(m_paths[chunk_index], std::ios::binary | std::ios::app);
+        out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(OutOfCoreTriangle));
+        if (!out) {
+            throw std::runtime_error("failed to write " + m_paths[chunk_index].string());
+        }
+        buffer.clear();
+    }
+
+    void FlushAll() {
+        for (uint32 chunk_index = 0; chunk_index < m_buffers.size(); chunk_index++) {
+            Flush(chunk_index);
+        }
+    }
+
+private:
+    static constexpr size_t BufferSize = 4096;
+
+    std::vector<std::filesystem::path>          m_paths;
+    std::vector<std::vector<OutOfCoreTriangle>> m_buffers;
+};
+
+// 读取分块文件，按位置焊接顶点，得到可以直接构建cluster的网格
+inline void LoadOutOfCoreChunk(const std::filesystem::path& path, bool has_materials, MeshData& mesh) {
+    std::vector<OutOfCoreTriangle> triangles;
+    {
+        std::error_code error;
+        const uintmax_t size = std::filesystem::file_size(path, error);
+        if (!error) {
+            std::ifstream in(path, std::ios::binary);
+            triangles.resize(size / sizeof(OutOfCoreTriangle));
+            in.read(reinterpret_cast<char*>(triangles.data()), triangles.size() * sizeof(OutOfCoreTriangle));
+            if (!in) {
+                throw std::runtime_error("failed to read " + path.string());
+            }
+        }
+    }
+
+    struct PositionHash {
+        size_t operator()(const Point3f& position) const { return HashPosition(position); }
+    };
+    std::unordered_map<Point3f, uint32, PositionHash> welded;
+    welded.reserve(triangles.size());
+
+    mesh.verts.Positions.clear();
+    mesh.indices.clear();
+    mesh.indices.reserve(triangles.size() * 3);
+    mesh.material_indexes.clear();
+    mesh.bounds = Bounds3f();
+
+    for (const auto& triangle: triangles) {
+        for (const auto& position: triangle.positions) {
+            auto [it, inserted] = welded.emplace(position, static_cast<uint32>(mesh.verts.Positions.size()));
+            if (inserted) {
+                mesh.verts.Positions.push_back(position);
+                mesh.bounds.AddPoint(position);
+            }
+            mesh.indices.push_back(it->second);
+        }
+
+        if (has_materials) {
+            mesh.material_indexes.push_back(triangle.material_index);
+        }
+    }
+}
+
+// 有向边的key，反向边的key交换高低位即可得到
+inline static uint64 OutOfCoreEdgeKey(const Point3f& position0, const Point3f& position1) {
+    return (uint64(HashPosition(position0)) << 32) | HashPosition(position1);
+}
+
+// 外存构建：按三角形质心的莫顿码前缀（与BuildLocalityLinks相同的key）将三角形分入空间上连续的分块并写入磁盘，
+// 每个分块独立构建cluster，接触分块边界的cluster被收集到接缝区域中重新划分，
+// 内存峰值由max_chunk_triangles和max_concurrent_chunks决定，而不是整个网格的大小
+inline OutOfCoreResult ClusterTrianglesOutOfCore(
+    TriangleStream&          stream,
+    const OutOfCoreSettings& settings,
+    const ClusterSink&       sink
+) {
+    OutOfCoreResult result;
+
+    Bounds3f bounds;
+    if (!stream.GetBounds(bounds)) {
+        throw std::runtime_error(stream.GetError());
+    }
+    const bool has_materials = stream.HasMaterials();
+
+    // 莫顿码的前15位，对应八叉树第5层的32768个格子
+    constexpr uint32 PrefixBits = 15;
+
+    auto GetPrefix = [&bounds](const Point3f (&positions)[3]) {
+        Point3f center = (positions[0] + positions[1] + positions[2]) * (1.0f / 3.0f);
+        return MortonKey3(center, bounds) >> (30 - PrefixBits);
+    };
+
+    // 统计每个格子中的三角形数
+    std::vector<uint64> prefix_counts(1u << PrefixBits, 0);
+    auto CountTriangle = [&](const Point3f (&positions)[3], int32) { prefix_counts[GetPrefix(positions)]++; };
+    if (!stream.ForEachTriangle(CountTriangle)) {
+        throw std::runtime_error(stream.GetError());
+    }
+
+    // 按莫顿顺序合并相邻的格子，单个格子超过上限时单独成为一个分块
+    std::vector<uint32> prefix_to_chunk(prefix_counts.size());
+    uint64              num_triangles = 0;
+    uint64              chunk_size    = 0;
+    uint32              num_chunks    = 0;
+    for (uint32 prefix = 0; prefix < prefix_counts.size(); prefix++) {
+        if (chunk_size > 0 && chunk_size + prefix_counts[prefix] > settings.max_chunk_triangles) {
+            num_chunks++;
+            chunk_size = 0;
+        }
+        prefix_to_chunk[prefix] = num_chunks;
+        chunk_size += prefix_counts[prefix];
+        num_triangles += prefix_counts[prefix];
+    }
+    num_chunks += chunk_size > 0 ? 1 : 0;
+
+    CHECK(num_triangles <= ~0u);
+    result.num_triangles = static_cast<uint32>(num_triangles);
+    result.num_chunks    = num_chunks;
+    if (num_chunks == 0) {
+        return result;
+    }
+
+    // 每次构建使用独立的临时目录，结束或异常时删除
+    struct SpillDirectory {
+        std::filesystem::path path;
+        ~SpillDirectory() {
+            std::error_code error;
+            std::filesystem::remove_all(path, error);
+        }
+    } spill { settings.spill_directory / ("OutOfCore" + std::to_string(std::random_device {}())) };
+    std::filesystem::create_directories(spill.path);
+
+    std::vector<std::filesystem::path> chunk_paths(num_chunks);
+    for (uint32 chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        chunk_paths[chunk_index] = spill.path / ("chunk" + std::to_string(chunk_index) + ".tri");
+    }
+    const std::filesystem::path seam_path = spill.path / "seam.tri";
+
+    // 第二次遍历，将三角形写入所属分块的文件
+    {
+        ChunkSpillWriter writer(chunk_paths);
+
+        auto SpillTriangle = [&](const Point3f (&positions)[3], int32 material_index) {
+            const uint32 chunk_index = prefix_to_chunk[GetPrefix(positions)];
+            writer.Add(chunk_index, { { positions[0], positions[1], positions[2] }, material_index });
+        };
+        if (!stream.ForEachTriangle(SpillTriangle)) {
+            throw std::runtime_error(stream.GetError());
+        }
+        writer.FlushAll();
+    }
+
+    // 同时最多构建max_concurrent_chunks个分块，分块内部的ParallelFor继续使用线程池
+    auto ForEachChunk = [&](auto&& Function) {
+        std::atomic<uint32> next_chunk { 0 };
+        auto                ChunkTask = [&]() {
+            for (uint32 chunk_index = next_chunk++; chunk_index < num_chunks; chunk_index = next_chunk++) {
+                Function(chunk_index);
+            }
+        };
+
+        TaskGroup group;
+        for (uint32 i = 1; i < std::min(settings.max_concurrent_chunks, num_chunks); i++) {
+            group.Run(ChunkTask);
+        }
+        ChunkTask();
+        group.Wait();
+    };
+
+    // 收集每个分块中没有匹配边的开放边，其中能与其他分块的开放边反向匹配的就是分块之间的接缝
+    std::vector<std::vector<uint64>> open_edges(num_chunks);
+    ForEachChunk([&](uint32 chunk_index) {
+        MeshData mesh;
+        LoadOutOfCoreChunk(chunk_paths[chunk_index], has_materials, mesh);
+
+        auto GetPosition = [&mesh](uint32 edge_index) { return mesh.verts.Positions[mesh.indices[edge_index]]; };
+
+        EdgeHash edge_hash(mesh.indices.size());
+        ParallelFor("ClusterTrianglesOutOfCore.ParallelFor", mesh.indices.size(), 4096, [&](int32 edge_index) {
+            edge_hash.AddConcurrent(edge_index, GetPosition);
+        });
+
+        for (uint32 edge_index = 0; edge_index < mesh.indices.size(); edge_index++) {
+            bool matched = false;
+            edge_hash.ForAllMatching(edge_index, false, GetPosition, [&matched](int32, int32) { matched = true; });
+            if (!matched) {
+                open_edges[chunk_index].push_back(
+                    OutOfCoreEdgeKey(GetPosition(edge_index), GetPosition(Cycle3(edge_index)))
+                );
+            }
+        }
+    });
+
+    // 开放边所属的分块，出现在多个分块中时记为~0u
+    std::unordered_map<uint64, uint32> open_edge_chunks;
+    for (uint32 chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        for (uint64 key: open_edges[chunk_index]) {
+            auto [it, inserted] = open_edge_chunks.emplace(key, chunk_index);
+            if (!inserted && it->second != chunk_index) {
+                it->second = ~0u;
+            }
+        }
+    }
+
+    // 哈希冲突只会让少量三角形被多余地放入接缝区域，不影响正确性
+    std::vector<std::unordered_set<uint64>> seam_edges(num_chunks);
+    for (uint32 chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        for (uint64 key: open_edges[chunk_index]) {
+            auto it = open_edge_chunks.find((key << 32) | (key >> 32));
+            if (it != open_edge_chunks.end() && it->second != chunk_index) {
+                seam_edges[chunk_index].insert(key);
+            }
+        }
+        open_edges[chunk_index].clear();
+        open_edges[chunk_index].shrink_to_fit();
+    }
+    open_edge_chunks.clear();
+
+    std::mutex    sink_mutex;
+    std::mutex    seam_mutex;
+    std::ofstream seam_file(seam_path, std::ios::binary | std::ios::trunc);
+
+    // 构建每个分块，接触接缝的cluster的三角形写入接缝文件，其余cluster直接输出
+    ForEachChunk([&](uint32 chunk_index) {
+        MeshData mesh;
+        LoadOutOfCoreChunk(chunk_paths[chunk_index], has_materials, mesh);
+
+        std::error_code error;
+        std::filesystem::remove(chunk_paths[chunk_index], error);
+
+        std::vector<Cluster> clusters;
+        ClusterPartition     partition;
+        ClusterTriangles(
+            mesh.verts,
+            mesh.indices,
+            mesh.material_indexes,
+            clusters,
+            mesh.bounds,
+            settings.cluster_settings,
+            &partition
+        );
+
+        const auto& chunk_seam_edges = seam_edges[chunk_index];
+
+        auto IsSeamTriangle = [&](uint32 tri_index) {
+            for (uint32 k = 0; k < 3; k++) {
+                const Point3f& position0 = mesh.verts.Positions[mesh.indices[tri_index * 3 + k]];
+                const Point3f& position1 = mesh.verts.Positions[mesh.indices[tri_index * 3 + (k + 1) % 3]];
+                if (chunk_seam_edges.contains(OutOfCoreEdgeKey(position0, position1))) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        std::vector<OutOfCoreTriangle> seam_triangles;
+        std::vector<Cluster>           interior_clusters;
+        interior_clusters.reserve(clusters.size());
+        for (uint32 cluster_index = 0; cluster_index < clusters.size(); cluster_index++) {
+            const auto& range = partition.ranges[cluster_index];
+
+            bool is_seam = false;
+            for (uint32 i = range.begin; i < range.end && !is_seam; i++) {
+                is_seam = IsSeamTriangle(partition.indices[i]);
+            }
+
+            if (!is_seam) {
+                interior_clusters.push_back(std::move(clusters[cluster_index]));
+                continue;
+            }
+
+            for (uint32 i = range.begin; i < range.end; i++) {
+                const uint32 tri_index = partition.indices[i];
+
+                OutOfCoreTriangle triangle;
+                for (uint32 k = 0; k < 3; k++) {
+                    triangle.positions[k] = mesh.verts.Positions[mesh.indices[tri_index * 3 + k]];
+                }
+                triangle.material_index = has_materials ? mesh.material_indexes[tri_index] : -1;
+                seam_triangles.push_back(triangle);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(seam_mutex);
+            seam_file.write(
+                reinterpret_cast<const char*>(seam_triangles.data()),
+                seam_triangles.size() * sizeof(OutOfCoreTriangle)
+            );
+            result.num_seam_triangles += static_cast<uint32>(seam_triangles.size());
+        }
+
+        std::lock_guard<std::mutex> lock(sink_mutex);
+        result.num_clusters += static_cast<uint32>(interior_clusters.size());
+        sink(chunk_index, interior_clusters);
+    });
+
+    seam_file.close();
+    if (!seam_file) {
+        throw std::runtime_error("failed to write " + seam_path.string());
+    }
+
+    // 接缝区域只包含分块边界两侧的一层cluster，一起重新划分
+    if (result.num_seam_triangles > 0) {
+        MeshData mesh;
+        LoadOutOfCoreChunk(seam_path, has_materials, mesh);
+
+        std::vector<Cluster> clusters;
+        ClusterTriangles(
+            mesh.verts,
+            mesh.indices,
+            mesh.material_indexes,
+            clusters,
+            mesh.bounds,
+            settings.cluster_settings
+        );
+
+        result.num_clusters += static_cast<uint32>(clusters.size());
+        sink(num_chunks, clusters);
+    }
+
+    return result;
+}
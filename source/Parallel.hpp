@@ -1,10 +1,401 @@
 #pragma once
 
 #include "Common.hpp"
+#include "Numa.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+// 全局共享的线程池，所有ParallelFor和批量构建任务都在这里调度
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(uint32 num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // 共享线程池，第一次调用时按SetNumThreads设置的线程数创建
+    static ThreadPool& Get();
+    // 必须在第一次调用Get之前设置，0表示使用全部硬件线程
+    static void SetNumThreads(uint32 num_threads) { s_num_threads = num_threads; }
+    // 必须在第一次调用Get之前设置。开启后工作线程按编号连续地分配到各个NUMA节点并绑定在节点上，
+    // ParallelFor中每个线程优先处理固定的一段，只有一个节点时不起作用
+    static void SetNumaAware(bool numa_aware) { s_numa_aware = numa_aware; }
+
+    uint32 NumWorkers() const { return static_cast<uint32>(m_workers.size()); }
+    bool   IsNumaAware() const { return m_numa_aware; }
+
+    // 当前线程在本线程池中的编号，不是工作线程时返回NumWorkers()
+    uint32 GetCurrentWorker() const { return t_pool == this ? t_worker_index : NumWorkers(); }
+    // 工作线程所在的NUMA节点
+    uint32 GetWorkerNode(uint32 worker) const { return m_numa_aware ? m_worker_nodes[worker] : 0; }
+
+    void Enqueue(Task task);
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::vector<uint32>      m_worker_nodes;
+    bool                     m_numa_aware = false;
+    std::deque<Task>         m_tasks;
+    std::mutex               m_mutex;
+    std::condition_variable  m_condition;
+    bool                     m_stop = false;
+
+    static inline uint32 s_num_threads = 0;
+    static inline bool   s_numa_aware  = false;
+
+    static inline thread_local const ThreadPool* t_pool         = nullptr;
+    static inline thread_local uint32            t_worker_index = 0;
+};
+
+inline ThreadPool::ThreadPool(uint32 num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    const uint32 num_workers = num_threads - 1;
+    const uint32 num_nodes   = NumaTopology::Get().NumNodes();
+
+    // 编号连续的工作线程位于同一个节点上，ParallelFor中相邻的段由同一个节点处理
+    m_numa_aware = s_numa_aware && num_nodes > 1 && num_workers > 0;
+    if (m_numa_aware) {
+        m_worker_nodes.resize(num_workers);
+        for (uint32 i = 0; i < num_workers; i++) {
+            m_worker_nodes[i] = static_cast<uint32>(uint64(i) * num_nodes / num_workers);
+        }
+    }
+
+    // 调用线程也会参与计算，所以只额外创建num_threads - 1个工作线程
+    m_workers.reserve(num_workers);
+    for (uint32 i = 0; i < num_workers; i++) {
+        m_workers.emplace_back([this, i] {
+            t_pool         = this;
+            t_worker_index = i;
+            if (m_numa_aware) {
+                NumaTopology::Get().PinCurrentThread(m_worker_nodes[i]);
+            }
+            WorkerLoop();
+        });
+    }
+}
+
+inline ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+
+    for (auto& worker: m_workers) {
+        worker.join();
+    }
+}
+
+inline ThreadPool& ThreadPool::Get() {
+    static ThreadPool pool(s_num_threads);
+    return pool;
+}
+
+inline void ThreadPool::Enqueue(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+inline void ThreadPool::WorkerLoop() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+            if (m_stop && m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+// 一组可以一起等待的任务，任务中可以继续向同一组添加任务。
+// 任务先放入组自己的队列，线程池中只放入一个从该队列领取任务的入口，
+// 等待时只帮忙执行本组的任务，不会在等待中执行其他组的长任务
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::Get()): m_pool(pool), m_state(std::make_shared<State>()) {}
+    ~TaskGroup() { WaitNoThrow(); }
+
+    TaskGroup(const TaskGroup&)            = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    template<typename FuncType>
+    void Run(FuncType&& Function);
+
+    // 等待所有任务完成，任务抛出的第一个异常会在这里重新抛出
+    void Wait();
+
+private:
+    struct State {
+        std::mutex                        mutex;
+        std::deque<std::function<void()>> tasks;
+        std::atomic<uint32>               num_pending { 0 };
+        std::exception_ptr                exception;
+
+        // 领取并执行本组的一个任务，队列为空时返回false
+        bool TryRunOne();
+    };
+
+    void WaitNoThrow();
+
+    ThreadPool&            m_pool;
+    std::shared_ptr<State> m_state; // 线程池中的入口可能晚于本组析构才执行，所以共享所有权
+};
+
+inline bool TaskGroup::State::TryRunOne() {
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty()) {
+            return false;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+    }
+
+    try {
+        task();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!exception) {
+            exception = std::current_exception();
+        }
+    }
+    num_pending--;
+    return true;
+}
+
+template<typename FuncType>
+inline void TaskGroup::Run(FuncType&& Function) {
+    m_state->num_pending++;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->tasks.emplace_back(std::forward<FuncType>(Function));
+    }
+    m_pool.Enqueue([state = m_state] { state->TryRunOne(); });
+}
+
+inline void TaskGroup::WaitNoThrow() {
+    while (m_state->num_pending > 0) {
+        // 等待期间帮忙执行本组排队中的任务
+        if (!m_state->TryRunOne()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+inline void TaskGroup::Wait() {
+    WaitNoThrow();
+
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        std::swap(exception, m_state->exception);
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
 
 template<typename FuncType>
 static inline void ParallelFor(const std::string& message, size_t count, int32 batch_size, FuncType&& Function) {
-    for (auto index = 0; index < count; ++index) {
-        Function(index);
+    ThreadPool&  pool        = ThreadPool::Get();
+    const size_t batch_count = static_cast<size_t>(std::max(batch_size, 1));
+    const size_t num_batches = DivideAndRoundUp(count, batch_count);
+
+    // 只有一个批次或者没有工作线程时直接串行执行
+    if (num_batches <= 1 || pool.NumWorkers() == 0) {
+        for (size_t index = 0; index < count; ++index) {
+            Function(index);
+        }
+        return;
+    }
+
+    auto RunBatch = [&](size_t batch) {
+        const size_t begin = batch * batch_count;
+        const size_t end   = std::min(begin + batch_count, count);
+        for (size_t index = begin; index < end; ++index) {
+            Function(index);
+        }
+    };
+
+    // 按线程编号把批次分成连续的段，每个线程先处理自己的段，再从后面的段中领取剩下的批次。
+    // 同样长度的循环中同一段总是优先由同一个线程处理，段内数组的内存页由它第一次写入，位于它所在的节点
+    // 没有开启NUMA时所有线程从同一个计数器中领取
+    struct alignas(64) Cursor {
+        std::atomic<size_t> next { 0 };
+        size_t              end = 0;
+    };
+    std::atomic<size_t> next_batch { 0 };
+    std::vector<Cursor> cursors(pool.IsNumaAware() ? pool.NumWorkers() + 1 : 0);
+    const uint32        num_slots = static_cast<uint32>(cursors.size());
+    for (uint32 slot = 0; slot < num_slots; slot++) {
+        cursors[slot].next = num_batches * slot / num_slots;
+        cursors[slot].end  = num_batches * (slot + 1) / num_slots;
+    }
+
+    // 调用线程也参与执行
+    auto ProcessBatches = [&]() {
+        if (cursors.empty()) {
+            for (size_t batch = next_batch++; batch < num_batches; batch = next_batch++) {
+                RunBatch(batch);
+            }
+            return;
+        }
+
+        const uint32 first_slot = std::min(pool.GetCurrentWorker(), num_slots - 1);
+        for (uint32 i = 0; i < num_slots; i++) {
+            Cursor& cursor = cursors[(first_slot + i) % num_slots];
+            for (size_t batch = cursor.next++; batch < cursor.end; batch = cursor.next++) {
+                RunBatch(batch);
+            }
+        }
+    };
+
+    TaskGroup group(pool);
+    for (size_t i = 0, num_helpers = std::min<size_t>(num_batches - 1, pool.NumWorkers()); i < num_helpers; i++) {
+        group.Run(ProcessBatches);
+    }
+    ProcessBatches();
+    group.Wait();
+}
+
+// 多个线程之间传递任务的队列，Close之后Pop取完剩余元素后返回空
+template<typename T>
+class WorkQueue {
+public:
+    void Push(T item);
+    // 队列为空时阻塞，关闭并且为空时返回std::nullopt
+    std::optional<T> Pop();
+    void             Close();
+
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    std::deque<T>           m_items;
+    bool                    m_closed = false;
+};
+
+template<typename T>
+inline void WorkQueue<T>::Push(T item) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.push_back(std::move(item));
     }
+    m_condition.notify_one();
+}
+
+template<typename T>
+inline std::optional<T> WorkQueue<T>::Pop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this] { return m_closed || !m_items.empty(); });
+    if (m_items.empty()) {
+        return std::nullopt;
+    }
+
+    std::optional<T> item = std::move(m_items.front());
+    m_items.pop_front();
+    return item;
+}
+
+template<typename T>
+inline void WorkQueue<T>::Close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_condition.notify_all();
+}
+
+// 限制同时存在的数据总量。超出上限时Acquire阻塞直到有数据释放，没有任何占用时总能获取，
+// 单个超过上限的数据也能继续处理
+class MemoryBudget {
+public:
+    explicit MemoryBudget(uint64 limit): m_limit(limit) {}
+
+    void Acquire(uint64 bytes);
+    void Release(uint64 bytes);
+
+    uint64 GetPeak() const { return m_peak; }
+
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    uint64                  m_limit;
+    uint64                  m_used = 0;
+    uint64                  m_peak = 0;
+};
+
+inline void MemoryBudget::Acquire(uint64 bytes) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [&] { return m_used == 0 || m_used + bytes <= m_limit; });
+    m_used += bytes;
+    m_peak = std::max(m_peak, m_used);
+}
+
+inline void MemoryBudget::Release(uint64 bytes) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_used -= bytes;
+    }
+    m_condition.notify_all();
+}
+
+// 分配时不初始化元素的分配器。大数组分配后由ParallelFor并行地第一次写入，
+// 省去调用线程串行清零的一趟，在NUMA系统上内存页也分配在写入它的线程所在的节点
+template<typename T>
+struct DefaultInitAllocator: std::allocator<T> {
+    using std::allocator<T>::allocator;
+
+    template<typename U>
+    struct rebind {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    template<typename U>
+    void construct(U* ptr) noexcept(std::is_nothrow_default_constructible_v<U>) {
+        ::new (static_cast<void*>(ptr)) U;
+    }
+    template<typename U, typename... ArgTypes>
+    void construct(U* ptr, ArgTypes&&... args) {
+        ::new (static_cast<void*>(ptr)) U(std::forward<ArgTypes>(args)...);
+    }
+};
+
+// 元素初始值由第一次写入决定的数组，resize之后的元素是未初始化的
+template<typename T>
+using FirstTouchVector = std::vector<T, DefaultInitAllocator<T>>;
+
+// 将数组调整为count个元素并用ParallelFor并行写入value
+template<typename T>
+inline void FirstTouchFill(FirstTouchVector<T>& data, size_t count, const T& value) {
+    data.resize(count);
+    ParallelFor("FirstTouchFill.ParallelFor", DivideAndRoundUp<size_t>(count, 16384), 1, [&](size_t chunk) {
+        const size_t begin = chunk * 16384;
+        std::fill(data.begin() + begin, data.begin() + std::min(begin + 16384, count), value);
+    });
 }
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Parallel.hpp"
+#include "ClusterBuilder.hpp"
+
+#include <ostream>
+
+// 划分结果的质量指标，用于调整划分参数
+struct PartitionMetrics {
+    uint32 num_triangles      = 0;
+    uint32 num_clusters       = 0;
+    int32  min_partition_size = 0;
+    int32  max_partition_size = 0;
+
+    // 下标为cluster的三角形数，值为cluster的个数
+    std::vector<uint32> size_histogram;
+    uint32              num_under_min = 0; // 三角形数少于min_partition_size的cluster数
+
+    // 被切开的共享边，权重与划分时图中的权重相同，不包括局部连接
+    uint64 edge_cut_weight = 0;
+    uint64 num_cut_edges   = 0;
+
+    // 在所属cluster内没有邻接边的三角形边，包括网格本身的边界
+    uint64 num_boundary_edges = 0;
+
+    uint64 num_locality_links = 0;
+
+    // 所有cluster包围盒的体积、半表面积之和与三角形面积之和，包围盒越紧凑运行时剔除越有效
+    double bounds_volume = 0.0;
+    double bounds_area   = 0.0;
+    double triangle_area = 0.0;
+
+    double GetFillRatio() const {
+        return num_clusters ? double(num_triangles) / (double(num_clusters) * max_partition_size) : 0.0;
+    }
+    double GetBoundsAreaRatio() const { return triangle_area > 0.0 ? bounds_area / triangle_area : 0.0; }
+
+    void WriteJson(std::ostream& out) const;
+};
+
+inline void PartitionMetrics::WriteJson(std::ostream& out) const {
+    out << "{\n";
+    out << "  \"num_triangles\": " << num_triangles << ",\n";
+    out << "  \"num_clusters\": " << num_clusters << ",\n";
+    out << "  \"min_partition_size\": " << min_partition_size << ",\n";
+    out << "  \"max_partition_size\": " << max_partition_size << ",\n";
+    out << "  \"fill_ratio\": " << GetFillRatio() << ",\n";
+    out << "  \"num_under_min\": " << num_under_min << ",\n";
+    out << "  \"size_histogram\": [";
+    for (size_t i = 0; i < size_histogram.size(); i++) {
+        out << (i ? ", " : "") << size_histogram[i];
+    }
+    out << "],\n";
+    out << "  \"edge_cut_weight\": " << edge_cut_weight << ",\n";
+    out << "  \"num_cut_edges\": " << num_cut_edges << ",\n";
+    out << "  \"num_boundary_edges\": " << num_boundary_edges << ",\n";
+    out << "  \"num_locality_links\": " << num_locality_links << ",\n";
+    out << "  \"bounds_volume\": " << bounds_volume << ",\n";
+    out << "  \"bounds_area\": " << bounds_area << ",\n";
+    out << "  \"triangle_area\": " << triangle_area << ",\n";
+    out << "  \"bounds_area_ratio\": " << GetBoundsAreaRatio() << "\n";
+    out << "}\n";
+}
+
+// 根据ClusterTriangles输出的划分计算质量指标。共享边用排序方式重新匹配，与构建时的邻接关系相同。
+// num_locality_links为构建时BuildStats中LocalityLinks.Count的值
+template<ClusterIndexType IndexType>
+inline PartitionMetrics ComputePartitionMetrics(
+    ConstStridedView<Vector3f>  positions,
+    std::span<const IndexType>  indices,
+    std::span<const int32>      material_indexes,
+    const ClusterPartition&     partition,
+    const ClusterBuildSettings& settings,
+    uint64                      num_locality_links = 0
+) {
+    const uint32 num_edges     = static_cast<uint32>(indices.size());
+    const uint32 num_triangles = num_edges / 3;
+    const uint32 num_clusters  = static_cast<uint32>(partition.ranges.size());
+
+    auto GetPosition = [positions, indices](uint32 edge_index) {
+        return positions[static_cast<int32>(indices[edge_index])];
+    };
+    auto GetMaterial = [material_indexes](uint32 tri_index) {
+        return material_indexes.empty() ? 0 : material_indexes[tri_index];
+    };
+
+    PartitionMetrics metrics;
+    metrics.num_triangles      = num_triangles;
+    metrics.num_clusters       = num_clusters;
+    metrics.min_partition_size = settings.min_partition_size;
+    metrics.max_partition_size = settings.max_partition_size;
+    metrics.num_locality_links = num_locality_links;
+
+    // 每个三角形所属的cluster
+    std::vector<uint32> cluster_of(num_triangles, ~0u);
+    ParallelFor("ComputePartitionMetrics.ParallelFor", num_clusters, 64, [&](uint32 cluster_index) {
+        const auto& range = partition.ranges[cluster_index];
+        for (uint32 i = range.begin; i < range.end; i++) {
+            cluster_of[partition.indices[i]] = cluster_index;
+        }
+    });
+
+    // 每个cluster的包围盒和三角形面积，按cluster的顺序累加，结果是确定的
+    std::vector<double> cluster_volume(num_clusters);
+    std::vector<double> cluster_bounds_area(num_clusters);
+    std::vector<double> cluster_triangle_area(num_clusters);
+    ParallelFor("ComputePartitionMetrics.ParallelFor", num_clusters, 64, [&](uint32 cluster_index) {
+        const auto& range = partition.ranges[cluster_index];
+
+        Bounds3f bounds;
+        double   area = 0.0;
+        for (uint32 i = range.begin; i < range.end; i++) {
+            const uint32   tri_index = partition.indices[i];
+            const Vector3f p0        = GetPosition(tri_index * 3 + 0);
+            const Vector3f p1        = GetPosition(tri_index * 3 + 1);
+            const Vector3f p2        = GetPosition(tri_index * 3 + 2);
+            bounds.AddPoint(p0);
+            bounds.AddPoint(p1);
+            bounds.AddPoint(p2);
+            area += 0.5 * (p1 - p0).Cross(p2 - p0).Length();
+        }
+
+        const Vector3f size                  = bounds.GetDimensions();
+        cluster_volume[cluster_index]        = double(size.x) * size.y * size.z;
+        cluster_bounds_area[cluster_index]   = double(size.x) * (size.y + size.z) + double(size.y) * size.z;
+        cluster_triangle_area[cluster_index] = area;
+    });
+
+    metrics.size_histogram.resize(std::max(0, settings.max_partition_size) + 1);
+    for (uint32 cluster_index = 0; cluster_index < num_clusters; cluster_index++) {
+        const auto&  range = partition.ranges[cluster_index];
+        const uint32 size  = std::min<uint32>(range.end - range.begin, uint32(metrics.size_histogram.size()) - 1);
+        metrics.size_histogram[size]++;
+        metrics.num_under_min += size < uint32(settings.min_partition_size) ? 1 : 0;
+
+        metrics.bounds_volume += cluster_volume[cluster_index];
+        metrics.bounds_area += cluster_bounds_area[cluster_index];
+        metrics.triangle_area += cluster_triangle_area[cluster_index];
+    }
+
+    // 重新建立边的邻接关系，统计跨cluster的共享边
+    Adjacency                            adjacency(num_edges);
+    std::vector<std::pair<int32, int32>> complex_links;
+    MatchEdgesSorted(num_edges, GetPosition, adjacency, complex_links);
+    adjacency.LinkSorted(complex_links);
+
+    constexpr uint32 ChunkSize  = 4096;
+    const uint32     num_chunks = DivideAndRoundUp(num_edges, ChunkSize);
+
+    std::vector<uint64> chunk_cut_weight(num_chunks);
+    std::vector<uint64> chunk_cut_edges(num_chunks);
+    std::vector<uint64> chunk_boundary_edges(num_chunks);
+    ParallelFor("ComputePartitionMetrics.ParallelFor", num_chunks, 1, [&](size_t chunk) {
+        const uint32 chunk_begin = static_cast<uint32>(chunk) * ChunkSize;
+        const uint32 chunk_end   = std::min(chunk_begin + ChunkSize, num_edges);
+        for (uint32 edge_index = chunk_begin; edge_index < chunk_end; edge_index++) {
+            const uint32 tri_index = edge_index / 3;
+
+            bool internal = false;
+            adjacency.ForAll(edge_index, [&](int32, int32 adj_index) {
+                const uint32 adj_tri_index = adj_index / 3;
+                if (cluster_of[adj_tri_index] == cluster_of[tri_index]) {
+                    internal = true;
+                } else {
+                    chunk_cut_weight[chunk] += settings.GetEdgeCost(GetMaterial(tri_index), GetMaterial(adj_tri_index));
+                    chunk_cut_edges[chunk]++;
+                }
+            });
+            chunk_boundary_edges[chunk] += internal ? 0 : 1;
+        }
+    });
+
+    // 每条被切开的共享边在两侧各统计了一次
+    for (uint32 chunk = 0; chunk < num_chunks; chunk++) {
+        metrics.edge_cut_weight += chunk_cut_weight[chunk];
+        metrics.num_cut_edges += chunk_cut_edges[chunk];
+        metrics.num_boundary_edges += chunk_boundary_edges[chunk];
+    }
+    metrics.edge_cut_weight /= 2;
+    metrics.num_cut_edges /= 2;
+    return metrics;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Parallel.hpp"
+#include "Math/BoundingBox.hpp"
+
+#include <span>
+
+// 点集上的均匀网格，按格子连续存储点，用于查询k个最近的点。
+// 格子的边长按点的平均密度确定，尺寸为0的轴只有一层格子
+class PointGrid {
+public:
+    PointGrid(std::span<const Point3f> points, const Bounds3f& bounds, uint32 points_per_cell = 2);
+
+    // 按距离从近到远查找至多k个满足Filter的点，max_distance为0时不限制距离。
+    // 结果按距离升序写入out_indices和out_dist2，返回找到的数量。距离相同时先访问到的点在前，结果是确定的
+    template<typename FilterType>
+    uint32 FindNearest(
+        const Point3f& point,
+        float          max_distance,
+        uint32         k,
+        FilterType&&   Filter,
+        uint32*        out_indices,
+        float*         out_dist2
+    ) const;
+
+    size_t GetAllocatedSize() const;
+
+private:
+    uint32 GetCellCoord(const Point3f& point, uint32 axis) const;
+    uint32 GetCellIndex(uint32 x, uint32 y, uint32 z) const { return (z * m_dims[1] + y) * m_dims[0] + x; }
+
+    // 点到格子的最近距离的平方
+    float GetCellDistance2(const Point3f& point, uint32 x, uint32 y, uint32 z) const;
+
+    float  m_min[3];
+    float  m_cell_size[3];
+    uint32 m_dims[3];
+    float  m_min_cell_size; // 多于一层格子的轴中最小的格子边长，用于判断何时停止向外搜索
+
+    std::vector<uint32>  m_cell_start; // 每个格子在m_points中的起始位置，最后一个元素为点的总数
+    std::vector<Point3f> m_points; // 按格子排列的点
+    std::vector<uint32>  m_indices; // m_points中每个点的原始索引
+};
+
+inline PointGrid::PointGrid(std::span<const Point3f> points, const Bounds3f& bounds, uint32 points_per_cell) {
+    const uint32   num_points = static_cast<uint32>(points.size());
+    const Vector3f min        = bounds.GetMin();
+    const Vector3f extent     = bounds.GetDimensions();
+    const float    extents[3] = { extent.x, extent.y, extent.z };
+
+    // 按非零尺寸的轴计算格子边长，使格子数约为点数除以points_per_cell，格子数不会超过这个值
+    const float target_cells = std::max(1.0f, float(num_points) / std::max(1u, points_per_cell));
+    float       volume       = 1.0f;
+    uint32      num_axes     = 0;
+    for (uint32 axis = 0; axis < 3; axis++) {
+        if (extents[axis] > 0.0f) {
+            volume *= extents[axis];
+            num_axes++;
+        }
+    }
+    const float cell_size = num_axes ? std::pow(volume / target_cells, 1.0f / num_axes) : 0.0f;
+
+    m_min[0]        = min.x;
+    m_min[1]        = min.y;
+    m_min[2]        = min.z;
+    m_min_cell_size = FLT_MAX;
+    for (uint32 axis = 0; axis < 3; axis++) {
+        const float dims = extents[axis] > 0.0f ? std::floor(extents[axis] / cell_size) : 1.0f;
+
+        m_dims[axis]      = static_cast<uint32>(std::clamp(dims, 1.0f, 1024.0f));
+        m_cell_size[axis] = extents[axis] / m_dims[axis];
+        if (m_dims[axis] > 1) {
+            m_min_cell_size = std::min(m_min_cell_size, m_cell_size[axis]);
+        }
+    }
+
+    // 计数排序，同一格子内的点保持原有顺序
+    std::vector<uint32> cell_indices(num_points);
+    ParallelFor("PointGrid.ParallelFor", num_points, 4096, [&](uint32 index) {
+        const Point3f& point = points[index];
+        cell_indices[index]  = GetCellIndex(GetCellCoord(point, 0), GetCellCoord(point, 1), GetCellCoord(point, 2));
+    });
+
+    m_cell_start.assign(size_t(m_dims[0]) * m_dims[1] * m_dims[2] + 1, 0);
+    for (uint32 cell_index: cell_indices) {
+        m_cell_start[cell_index + 1]++;
+    }
+    for (size_t i = 1; i < m_cell_start.size(); i++) {
+        m_cell_start[i] += m_cell_start[i - 1];
+    }
+
+    std::vector<uint32> offsets(m_cell_start.begin(), m_cell_start.end() - 1);
+    m_points.resize(num_points);
+    m_indices.resize(num_points);
+    for (uint32 index = 0; index < num_points; index++) {
+        const uint32 dst = offsets[cell_indices[index]]++;
+        m_points[dst]    = points[index];
+        m_indices[dst]   = index;
+    }
+}
+
+inline uint32 PointGrid::GetCellCoord(const Point3f& point, uint32 axis) const {
+    const float coord = axis == 0 ? point.x : (axis == 1 ? point.y : point.z);
+    const float local = m_cell_size[axis] > 0.0f ? (coord - m_min[axis]) / m_cell_size[axis] : 0.0f;
+    return std::min(static_cast<uint32>(std::max(local, 0.0f)), m_dims[axis] - 1);
+}
+
+inline float PointGrid::GetCellDistance2(const Point3f& point, uint32 x, uint32 y, uint32 z) const {
+    const float  coords[3] = { point.x, point.y, point.z };
+    const uint32 cell[3]   = { x, y, z };
+
+    float dist2 = 0.0f;
+    for (uint32 axis = 0; axis < 3; axis++) {
+        const float cell_min = m_min[axis] + cell[axis] * m_cell_size[axis];
+        const float cell_max = cell_min + m_cell_size[axis];
+        const float d        = std::max({ 0.0f, cell_min - coords[axis], coords[axis] - cell_max });
+        dist2 += d * d;
+    }
+    return dist2;
+}
+
+template<typename FilterType>
+inline uint32 PointGrid::FindNearest(
+    const Point3f& point,
+    float          max_distance,
+    uint32         k,
+    FilterType&&   Filter,
+    uint32*        out_indices,
+    float*         out_dist2
+) const {
+    const float max_dist2 = max_distance > 0.0f ? max_distance * max_distance : FLT_MAX;
+
+    uint32 num_found = 0;
+    auto   Worst2    = [&] { return num_found == k ? out_dist2[k - 1] : max_dist2; };
+
+    auto VisitCell = [&](uint32 x, uint32 y, uint32 z) {
+        if (GetCellDistance2(point, x, y, z) > Worst2()) {
+            return;
+        }
+
+        const uint32 cell_index = GetCellIndex(x, y, z);
+        for (uint32 i = m_cell_start[cell_index]; i < m_cell_start[cell_index + 1]; i++) {
+            const float dist2 = Math::Vector3::DistanceSquared(point, m_points[i]);
+            if (dist2 > max_dist2 || (num_found == k && dist2 >= out_dist2[k - 1]) || !Filter(m_indices[i])) {
+                continue;
+            }
+
+            // 插入排序，维护按距离升序的结果
+            uint32 slot = num_found < k ? num_found++ : k - 1;
+            while (slot > 0 && dist2 < out_dist2[slot - 1]) {
+                out_dist2[slot]   = out_dist2[slot - 1];
+                out_indices[slot] = out_indices[slot - 1];
+                slot--;
+            }
+            out_dist2[slot]   = dist2;
+            out_indices[slot] = m_indices[i];
+        }
+    };
+
+    const int32 center[3] = {
+        static_cast<int32>(GetCellCoord(point, 0)),
+        static_cast<int32>(GetCellCoord(point, 1)),
+        static_cast<int32>(GetCellCoord(point, 2)),
+    };
+    const int32 max_ring = static_cast<int32>(std::max({ m_dims[0], m_dims[1], m_dims[2] })) - 1;
+
+    // 一圈一圈向外访问与中心格子的切比雪夫距离为ring的格子
+    for (int32 ring = 0; ring <= max_ring; ring++) {
+        int32 lo[3];
+        int32 hi[3];
+        for (uint32 axis = 0; axis < 3; axis++) {
+            lo[axis] = std::max(center[axis] - ring, 0);
+            hi[axis] = std::min(center[axis] + ring, static_cast<int32>(m_dims[axis]) - 1);
+        }
+
+        for (int32 z = lo[2]; z <= hi[2]; z++) {
+            for (int32 y = lo[1]; y <= hi[1]; y++) {
+                // 不在外壳上的行只有两端的格子属于这一圈
+                const bool  on_shell = std::abs(z - center[2]) == ring || std::abs(y - center[1]) == ring;
+                const int32 x_step   = on_shell ? 1 : 2 * ring;
+                for (int32 x = center[0] - ring; x <= center[0] + ring; x += std::max(x_step, 1)) {
+                    if (x >= lo[0] && x <= hi[0]) {
+                        VisitCell(x, y, z);
+                    }
+                }
+            }
+        }
+
+        // 更外一圈的点距离至少为ring个格子
+        const float ring_dist = ring * m_min_cell_size;
+        if (ring_dist * ring_dist >= Worst2()) {
+            break;
+        }
+    }
+    return num_found;
+}
+
+inline size_t PointGrid::GetAllocatedSize() const {
+    return (m_cell_start.capacity() + m_indices.capacity()) * sizeof(uint32) + m_points.capacity() * sizeof(Point3f);
+}
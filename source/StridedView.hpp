@@ -31,8 +31,8 @@ public:
     StridedView(const StridedView<OtherElementType, SizeType>& other):
         m_address(nullptr),
         m_stride(other.Stride()),
-        m_num(other.num()) {
-        if (other.num() > 0) {
+        m_num(other.Num()) {
+        if (other.Num() > 0) {
             m_address = &other[0];
         }
     }
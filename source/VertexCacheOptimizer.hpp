@@ -0,0 +1,252 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Cluster.hpp"
+#include "Parallel.hpp"
+
+// 基于Forsyth的线性时间顶点缓存优化，按cluster的规模使用固定大小的临时数据
+class ClusterVertexCacheOptimizer {
+public:
+    static constexpr uint32 MaxTris   = Cluster::ClusterSize;
+    static constexpr uint32 MaxVerts  = MaxTris * 3;
+    static constexpr uint32 CacheSize = 32; // 优化时模拟的LRU缓存大小
+
+    ClusterVertexCacheOptimizer();
+
+    // 重排cluster内三角形的顺序，并按首次使用的顺序重新编号顶点。
+    // 超过MaxTris的cluster保持不变并返回false
+    bool Optimize(Cluster& cluster);
+
+private:
+    float GetVertexScore(uint32 vert_index) const;
+
+    // 与顶点数量无关的得分表
+    float m_cache_score[CacheSize];
+    float m_valence_score[MaxTris + 1];
+
+    uint16 m_tri_offsets[MaxVerts + 1]; // 每个顶点的三角形列表在m_vert_tris中的起始位置
+    uint16 m_vert_tris[MaxTris * 3];
+    uint16 m_live_valence[MaxVerts]; // 尚未输出的相邻三角形数
+    int16  m_cache_position[MaxVerts]; // 顶点在缓存中的位置，-1表示不在缓存中
+    float  m_vert_score[MaxVerts];
+    float  m_tri_score[MaxTris];
+    bool   m_emitted[MaxTris];
+    uint16 m_cache[CacheSize + 3];
+    uint16 m_tri_order[MaxTris];
+
+    int32  m_vert_remap[MaxVerts];
+    uint32 m_new_indexes[MaxTris * 3];
+    int32  m_new_material_indexes[MaxTris];
+    float  m_new_verts[MaxVerts * 3];
+};
+
+inline ClusterVertexCacheOptimizer::ClusterVertexCacheOptimizer() {
+    // 刚使用过的三个顶点得分固定，避免总是优先选择与上一个三角形共享两个顶点的三角形
+    const float last_tri_score    = 0.75f;
+    const float cache_decay_power = 1.5f;
+    for (uint32 i = 0; i < CacheSize; i++) {
+        if (i < 3) {
+            m_cache_score[i] = last_tri_score;
+        } else {
+            const float scale = 1.0f / (CacheSize - 3);
+            m_cache_score[i]  = std::pow(1.0f - (i - 3) * scale, cache_decay_power);
+        }
+    }
+
+    // 剩余三角形越少的顶点越优先，尽早将其完全输出
+    const float valence_boost_scale = 2.0f;
+    const float valence_boost_power = 0.5f;
+    m_valence_score[0]              = 0.0f;
+    for (uint32 i = 1; i <= MaxTris; i++) {
+        m_valence_score[i] = valence_boost_scale * std::pow(static_cast<float>(i), -valence_boost_power);
+    }
+}
+
+inline float ClusterVertexCacheOptimizer::GetVertexScore(uint32 vert_index) const {
+    const uint32 valence = m_live_valence[vert_index];
+    if (valence == 0) {
+        return -1.0f;
+    }
+
+    const int32 position = m_cache_position[vert_index];
+    return (position >= 0 ? m_cache_score[position] : 0.0f) + m_valence_score[valence];
+}
+
+inline bool ClusterVertexCacheOptimizer::Optimize(Cluster& cluster) {
+    const uint32 num_tris  = cluster.NumTris;
+    const uint32 num_verts = cluster.NumVerts;
+    if (num_tris > MaxTris || num_verts > MaxVerts) {
+        return false;
+    }
+
+    // 建立顶点到三角形的列表
+    std::memset(m_live_valence, 0, num_verts * sizeof(uint16));
+    for (uint32 i = 0; i < num_tris * 3; i++) {
+        m_live_valence[cluster.Indexes[i]]++;
+    }
+
+    m_tri_offsets[0] = 0;
+    for (uint32 v = 0; v < num_verts; v++) {
+        m_tri_offsets[v + 1] = m_tri_offsets[v] + m_live_valence[v];
+    }
+
+    // 借用m_vert_remap作为写入位置
+    for (uint32 v = 0; v < num_verts; v++) {
+        m_vert_remap[v] = m_tri_offsets[v];
+    }
+    for (uint32 tri_index = 0; tri_index < num_tris; tri_index++) {
+        for (uint32 k = 0; k < 3; k++) {
+            m_vert_tris[m_vert_remap[cluster.Indexes[tri_index * 3 + k]]++] = static_cast<uint16>(tri_index);
+        }
+    }
+
+    for (uint32 v = 0; v < num_verts; v++) {
+        m_cache_position[v] = -1;
+        m_vert_score[v]     = GetVertexScore(v);
+    }
+
+    for (uint32 tri_index = 0; tri_index < num_tris; tri_index++) {
+        m_emitted[tri_index]   = false;
+        m_tri_score[tri_index] = m_vert_score[cluster.Indexes[tri_index * 3 + 0]] +
+                                 m_vert_score[cluster.Indexes[tri_index * 3 + 1]] +
+                                 m_vert_score[cluster.Indexes[tri_index * 3 + 2]];
+    }
+
+    uint32 cache_size = 0;
+    for (uint32 num_emitted = 0; num_emitted < num_tris; num_emitted++) {
+        // cluster最多只有MaxTris个三角形，直接线性查找得分最高的三角形
+        uint32 best_tri   = ~0u;
+        float  best_score = -1.0f;
+        for (uint32 tri_index = 0; tri_index < num_tris; tri_index++) {
+            if (!m_emitted[tri_index] && m_tri_score[tri_index] > best_score) {
+                best_score = m_tri_score[tri_index];
+                best_tri   = tri_index;
+            }
+        }
+        CHECK(best_tri != ~0u);
+
+        m_emitted[best_tri]      = true;
+        m_tri_order[num_emitted] = static_cast<uint16>(best_tri);
+
+        // 新三角形的顶点移到缓存最前面，其余顶点依次后移
+        uint16 new_cache[CacheSize + 3];
+        uint32 new_cache_size = 0;
+        for (uint32 k = 0; k < 3; k++) {
+            const uint16 v = static_cast<uint16>(cluster.Indexes[best_tri * 3 + k]);
+            m_live_valence[v]--;
+            new_cache[new_cache_size++] = v;
+        }
+        for (uint32 i = 0; i < cache_size; i++) {
+            const uint16 v = m_cache[i];
+            if (v != new_cache[0] && v != new_cache[1] && v != new_cache[2]) {
+                new_cache[new_cache_size++] = v;
+            }
+        }
+
+        // 更新缓存中和被挤出缓存的顶点的得分，以及它们相邻的三角形的得分
+        for (uint32 i = 0; i < new_cache_size; i++) {
+            const uint16 v = new_cache[i];
+
+            m_cache_position[v] = i < CacheSize ? static_cast<int16>(i) : -1;
+
+            const float score_delta = GetVertexScore(v) - m_vert_score[v];
+            m_vert_score[v] += score_delta;
+            for (uint32 t = m_tri_offsets[v]; t < m_tri_offsets[v + 1]; t++) {
+                m_tri_score[m_vert_tris[t]] += score_delta;
+            }
+        }
+
+        cache_size = std::min(new_cache_size, CacheSize);
+        std::memcpy(m_cache, new_cache, cache_size * sizeof(uint16));
+    }
+
+    // 按新的三角形顺序重写索引，顶点按首次使用的顺序重新编号
+    for (uint32 v = 0; v < num_verts; v++) {
+        m_vert_remap[v] = -1;
+    }
+
+    uint32 num_new_verts = 0;
+    for (uint32 i = 0; i < num_tris; i++) {
+        const uint32 tri_index = m_tri_order[i];
+        for (uint32 k = 0; k < 3; k++) {
+            const uint32 old_index = cluster.Indexes[tri_index * 3 + k];
+            if (m_vert_remap[old_index] < 0) {
+                m_vert_remap[old_index] = static_cast<int32>(num_new_verts);
+                std::memcpy(
+                    &m_new_verts[num_new_verts * Cluster::GetVertSize()],
+                    &cluster.Verts[old_index * Cluster::GetVertSize()],
+                    Cluster::GetVertSize() * sizeof(float)
+                );
+                num_new_verts++;
+            }
+            m_new_indexes[i * 3 + k] = static_cast<uint32>(m_vert_remap[old_index]);
+        }
+        m_new_material_indexes[i] = cluster.MaterialIndexes[tri_index];
+    }
+    CHECK(num_new_verts == num_verts);
+
+    std::memcpy(cluster.Indexes.data(), m_new_indexes, num_tris * 3 * sizeof(uint32));
+    std::memcpy(cluster.MaterialIndexes.data(), m_new_material_indexes, num_tris * sizeof(int32));
+    std::memcpy(cluster.Verts.data(), m_new_verts, num_verts * Cluster::GetVertSize() * sizeof(float));
+    return true;
+}
+
+// 使用FIFO缓存模拟顶点变换后缓存，返回缓存未命中次数
+inline uint32 ComputeVertexCacheMisses(const uint32* indexes, uint32 num_indexes, uint32 cache_size = 16) {
+    constexpr uint32 MaxCacheSize = 64;
+    CHECK(cache_size <= MaxCacheSize);
+
+    uint32 cache[MaxCacheSize];
+    uint32 cache_head = 0;
+    uint32 cache_num  = 0;
+    uint32 misses     = 0;
+    for (uint32 i = 0; i < num_indexes; i++) {
+        const uint32 index = indexes[i];
+        if (std::find(cache, cache + cache_num, index) != cache + cache_num) {
+            continue;
+        }
+
+        misses++;
+        cache[cache_head] = index;
+        cache_head        = (cache_head + 1) % cache_size;
+        cache_num         = std::min(cache_num + 1, cache_size);
+    }
+    return misses;
+}
+
+// ACMR（平均每个三角形的缓存未命中次数）统计
+struct VertexCacheReport {
+    uint64 num_tris      = 0;
+    uint64 misses_before = 0;
+    uint64 misses_after  = 0;
+    uint32 num_skipped   = 0; // 超过固定大小而没有优化的cluster数
+
+    double GetACMRBefore() const { return num_tris ? double(misses_before) / num_tris : 0.0; }
+    double GetACMRAfter() const { return num_tris ? double(misses_after) / num_tris : 0.0; }
+};
+
+// 并行优化每个cluster的三角形顺序，每个线程使用自己的固定大小临时数据
+inline VertexCacheReport OptimizeClusterVertexCache(Cluster* clusters, size_t num_clusters) {
+    std::vector<uint32> misses_before(num_clusters);
+    std::vector<uint32> misses_after(num_clusters);
+    std::vector<uint8>  optimized(num_clusters);
+
+    ParallelFor("OptimizeClusterVertexCache.ParallelFor", num_clusters, 64, [&](size_t index) {
+        static thread_local ClusterVertexCacheOptimizer optimizer;
+
+        Cluster& cluster = clusters[index];
+
+        misses_before[index] = ComputeVertexCacheMisses(cluster.Indexes.data(), cluster.NumTris * 3);
+        optimized[index]     = optimizer.Optimize(cluster);
+        misses_after[index]  = ComputeVertexCacheMisses(cluster.Indexes.data(), cluster.NumTris * 3);
+    });
+
+    VertexCacheReport report;
+    for (size_t index = 0; index < num_clusters; index++) {
+        report.num_tris += clusters[index].NumTris;
+        report.misses_before += misses_before[index];
+        report.misses_after += misses_after[index];
+        report.num_skipped += optimized[index] ? 0 : 1;
+    }
+    return report;
+}
@@ -1,139 +1,538 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+
 #include "Common.hpp"
 #include "Cluster.hpp"
-#include "Parallel.hpp"
-#include "StridedView.hpp"
-#include "EdgeHash.hpp"
-#include "VectorMath.hpp"
-#include "Adjacency.hpp"
-#include "DisjointSet.hpp"
-#include "GraphPartitioner.hpp"
-
-struct MeshBuildVertexView {
-    std::vector<Point3f> Positions;
-};
-
-static void ClusterTriangles(
-    MeshBuildVertexView&       verts,
-    const std::vector<uint32>& indices,
-    const std::vector<int32>&  material_indexes,
-    std::vector<Cluster>&      clusters,
-    const Bounds3f&            mesh_bounds
-) {
-    uint32 num_triangles = static_cast<uint32>(indices.size() / 3);
-
-    Adjacency adjacency { indices.size() };
-    EdgeHash  edge_hash { indices.size() };
-
-    auto GetPosition = [&verts, &indices](uint32 edge_index) { return verts.Positions[indices[edge_index]]; };
-
-    // 将每个索引视作一条边，构建边的哈希表
-    ParallelFor("ClusterTriangles.ParalleFor", indices.size(), 4096, [&](int edge_index) {
-        edge_hash.AddConcurrent(edge_index, GetPosition);
-    });
-
-    // 将每个索引视作一条边，确定边的邻接关系
-    ParallelFor("ClusterTriangles.ParalleFor", indices.size(), 1024, [&](int32 edge_index) {
-        int32 adj_index = -1; // -1表示没有邻接边
-        int32 adj_count = 0;
-
-        // 遍历边的邻接边
-        edge_hash.ForAllMatching(edge_index, false, GetPosition, [&](int32 edge_index, int32 other_edge_index) {
-            adj_index = other_edge_index; // 记录邻接边的索引
-            adj_count++;
-        });
+#include "ClusterBuilder.hpp"
+#include "BatchBuilder.hpp"
+#include "ClusterCache.hpp"
+#include "OutOfCoreBuilder.hpp"
+#include "ClusterEncoder.hpp"
+#include "ClusterPagePacker.hpp"
+#include "ClusterBVH.hpp"
+#include "PartitionMetrics.hpp"
 
-        // 通常共边三角形的那条共边是一对方向相反的边互相邻接
-        if (adj_count > 1) adj_index = -2; // 如果超过了1条邻接边，说明是个复杂连接
+// 生成一个起伏的网格平面和若干独立的小三角形岛
+static void BuildSelfCheckMesh(MeshData& mesh, uint32 grid_size, uint32 num_islands) {
+    for (uint32 y = 0; y <= grid_size; y++) {
+        for (uint32 x = 0; x <= grid_size; x++) {
+            Point3f position(float(x), float(y), 0.25f * float((x * 7 + y * 3) % 5));
+            mesh.verts.Positions.push_back(position);
+            mesh.bounds.AddPoint(position);
+        }
+    }
 
-        adjacency.direct[edge_index] = adj_index; // 记录直接邻边
-    });
+    for (uint32 y = 0; y < grid_size; y++) {
+        for (uint32 x = 0; x < grid_size; x++) {
+            uint32 v0 = y * (grid_size + 1) + x;
+            uint32 v1 = v0 + 1;
+            uint32 v2 = v0 + grid_size + 1;
+            uint32 v3 = v2 + 1;
+            mesh.indices.insert(mesh.indices.end(), { v0, v1, v2, v1, v3, v2 });
+        }
+    }
 
-    DisjointSet disjoint_set(num_triangles);
+    for (uint32 i = 0; i < num_islands; i++) {
+        uint32  base   = static_cast<uint32>(mesh.verts.Positions.size());
+        Point3f origin = Point3f(float(i % grid_size), float(i / grid_size), 3.0f);
+        for (const Point3f& offset: { Point3f(0, 0, 0), Point3f(0.5f, 0, 0), Point3f(0, 0.5f, 0) }) {
+            mesh.verts.Positions.push_back(origin + offset);
+            mesh.bounds.AddPoint(origin + offset);
+        }
+        mesh.indices.insert(mesh.indices.end(), { base, base + 1, base + 2 });
+    }
 
-    // 遍历所有边，最终得到若干个互不连通的拓扑结构
-    for (uint32 edge_index = 0, num = static_cast<uint32>(indices.size()); edge_index < num; edge_index++) {
-        // 处理复杂边
-        if (adjacency.direct[edge_index] == -2) {
-            std::vector<std::pair<int32, int32>> edges;
-            // 收集所有匹配当前边的边
-            edge_hash.ForAllMatching(edge_index, false, GetPosition, [&](int32 edge_index0, int32 edge_index1) {
-                edges.emplace_back(edge_index0, edge_index1);
-            });
+    // 在网格第一行的部分边上各立两片三角形，使这条边被三个三角形共享，成为复杂边
+    for (uint32 x = 0; x + 1 < grid_size; x += 8) {
+        uint32  base   = static_cast<uint32>(mesh.verts.Positions.size());
+        Point3f middle = (mesh.verts.Positions[x] + mesh.verts.Positions[x + 1]) * 0.5f;
+        for (const Point3f& offset: { Point3f(0, -0.5f, 1), Point3f(0, -0.5f, -1) }) {
+            mesh.verts.Positions.push_back(middle + offset);
+            mesh.bounds.AddPoint(middle + offset);
+        }
+        mesh.indices.insert(mesh.indices.end(), { x + 1, x, base, x + 1, x, base + 1 });
+    }
 
-            // 标准库排序保证确定性
-            std::sort(edges.begin(), edges.end());
+    // 两个顶点重合的退化三角形
+    uint32 degenerate_base = static_cast<uint32>(mesh.verts.Positions.size());
+    for (const Point3f& position: { Point3f(0, 0, 5), Point3f(0, 0, 5), Point3f(1, 0, 5) }) {
+        mesh.verts.Positions.push_back(position);
+        mesh.bounds.AddPoint(position);
+    }
+    mesh.indices.insert(mesh.indices.end(), { degenerate_base, degenerate_base + 1, degenerate_base + 2 });
 
-            // 建立邻接关系
-            for (const auto& edge: edges) {
-                adjacency.Link(edge.first, edge.second);
-            }
+    mesh.material_indexes.resize(mesh.NumTriangles());
+    for (uint32 i = 0; i < mesh.NumTriangles(); i++) {
+        mesh.material_indexes[i] = i % 3 == 0 ? 1 : 0;
+    }
+}
+
+// 将网格写成obj文件，用于检查批量构建
+static void WriteSelfCheckObj(const MeshData& mesh, const std::filesystem::path& path) {
+    std::ofstream out(path);
+    for (const Point3f& position: mesh.verts.Positions) {
+        out << "v " << position.x << " " << position.y << " " << position.z << "\n";
+    }
+    for (uint32 i = 0; i < mesh.indices.size(); i += 3) {
+        out << "f " << mesh.indices[i] + 1 << " " << mesh.indices[i + 1] + 1 << " " << mesh.indices[i + 2] + 1 << "\n";
+    }
+}
+
+static std::string ReadSelfCheckFile(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// 流水线批量构建与逐个构建的输出文件逐字节一致，内存上限小于单个网格时也能完成
+static void RunBatchSelfCheck() {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "NaniteSelfCheckBatch";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "meshes");
+
+    for (uint32 i = 0; i < 4; i++) {
+        MeshData mesh;
+        BuildSelfCheckMesh(mesh, 16 + i * 16, 10 * i);
+        WriteSelfCheckObj(mesh, directory / "meshes" / ("mesh" + std::to_string(i) + ".obj"));
+    }
+    const std::vector<BatchInput> inputs = CollectBatchInputs(directory / "meshes");
+
+    BatchBuildSettings sequential_settings;
+    sequential_settings.output_directory = directory / "sequential";
+
+    BuildStats         pipeline_stats;
+    BatchBuildSettings pipelined_settings = sequential_settings;
+    pipelined_settings.output_directory   = directory / "pipelined";
+    pipelined_settings.pipelined          = true;
+    pipelined_settings.pipeline_memory    = 1;
+    pipelined_settings.stats              = &pipeline_stats;
+
+    const std::vector<BatchBuildResult> sequential_results = BuildBatch(inputs, sequential_settings);
+    const std::vector<BatchBuildResult> pipelined_results  = BuildBatch(inputs, pipelined_settings);
+    CHECK(sequential_results.size() == inputs.size() && pipelined_results.size() == inputs.size());
+    for (uint32 i = 0; i < inputs.size(); i++) {
+        CHECK(sequential_results[i].succeeded && pipelined_results[i].succeeded);
+        CHECK(sequential_results[i].num_clusters == pipelined_results[i].num_clusters);
+
+        const std::string sequential_blob = ReadSelfCheckFile(directory / "sequential" / inputs[i].output);
+        CHECK(!sequential_blob.empty());
+        CHECK(sequential_blob == ReadSelfCheckFile(directory / "pipelined" / inputs[i].output));
+    }
+    // 上限小于任何一个网格，同时只有一个网格在流水线中
+    uint64 max_file_size = 0;
+    for (const auto& input: inputs) {
+        max_file_size = std::max<uint64>(max_file_size, std::filesystem::file_size(input.source));
+    }
+    CHECK(pipeline_stats.GetCounter("Pipeline.PeakBytes") == max_file_size);
+
+    std::filesystem::remove_all(directory);
+    std::cout << "Pipelined batch matches sequential batch (" << inputs.size() << " meshes)\n";
+}
+
+// 构建一个非平凡网格，检查划分结果并验证缓存的写入和读取结果一致
+static bool RunSelfCheck() {
+    MeshData mesh;
+    BuildSelfCheckMesh(mesh, 96, 200);
+
+    const std::filesystem::path cache_directory = std::filesystem::temp_directory_path() / "NaniteSelfCheckCache";
+    std::filesystem::remove_all(cache_directory);
+    ClusterCache cache(cache_directory);
+
+    ClusterBuildSettings settings;
+
+    std::vector<Cluster> clusters;
+    ClusterPartition     partition;
+    bool                 first_hit = ClusterTrianglesCached(
+        &cache, mesh.verts, mesh.indices, mesh.material_indexes, clusters, mesh.bounds, settings, &partition
+    );
+
+    std::vector<Cluster> cached_clusters;
+    ClusterPartition     cached_partition;
+    bool                 second_hit = ClusterTrianglesCached(
+        &cache,
+        mesh.verts,
+        mesh.indices,
+        mesh.material_indexes,
+        cached_clusters,
+        mesh.bounds,
+        settings,
+        &cached_partition
+    );
+
+    // 每个三角形恰好属于一个cluster，且cluster大小不超过上限
+    std::vector<uint32> tri_counts(mesh.NumTriangles(), 0);
+    for (const auto& range: partition.ranges) {
+        CHECK(range.end - range.begin <= uint32(settings.max_partition_size));
+        for (uint32 i = range.begin; i < range.end; i++) {
+            tri_counts[partition.indices[i]]++;
         }
+    }
+    CHECK(std::all_of(tri_counts.begin(), tri_counts.end(), [](uint32 count) { return count == 1; }));
 
-        // 遍历当前边的邻接边
-        adjacency.ForAll(edge_index, [&](int32 edge_index0, int32 edge_index1) {
-            // 合并邻边三角形
-            if (edge_index0 > edge_index1) {
-                // 随着连续合并操作，三角形间形成一条路径链，最大索引的三角形自然成为整个连通结构的终点
-                disjoint_set.UnionSequential(edge_index0 / 3, edge_index1 / 3);
-            }
-        });
+    uint32 num_cluster_tris = 0;
+    for (const auto& cluster: clusters) {
+        num_cluster_tris += cluster.NumTris;
+    }
+    CHECK(num_cluster_tris == mesh.NumTriangles());
+
+    CHECK(!first_hit && second_hit);
+    CHECK(cached_partition.indices == partition.indices);
+    CHECK(cached_clusters.size() == clusters.size());
+    for (size_t i = 0; i < clusters.size(); i++) {
+        CHECK(cached_clusters[i].Verts == clusters[i].Verts);
+        CHECK(cached_clusters[i].Indexes == clusters[i].Indexes);
+        CHECK(cached_clusters[i].MaterialIndexes == clusters[i].MaterialIndexes);
+    }
+
+    std::filesystem::remove_all(cache_directory);
+
+    // 低内存模式只改变中间数据结构的存储方式，划分结果必须一致
+    ClusterBuildSettings low_memory_settings = settings;
+    low_memory_settings.memory_budget        = 1;
+
+    BuildStats           stats;
+    std::vector<Cluster> low_memory_clusters;
+    ClusterPartition     low_memory_partition;
+    ClusterTriangles(
+        mesh.verts,
+        mesh.indices,
+        mesh.material_indexes,
+        low_memory_clusters,
+        mesh.bounds,
+        low_memory_settings,
+        &low_memory_partition,
+        &stats
+    );
+    CHECK(low_memory_partition.indices == partition.indices);
+    CHECK(low_memory_partition.ranges.size() == partition.ranges.size());
+
+    stats.Print(std::cout);
+
+#if HASH_TABLE_STATS
+    // 每条边在边哈希表中出现一次，并且恰好查询一次
+    CHECK(stats.GetCounter("EdgeHash.Entries") == mesh.indices.size());
+    CHECK(stats.GetCounter("EdgeHash.Queries") == mesh.indices.size());
+    CHECK(stats.GetCounter("EdgeHash.Matches") <= stats.GetCounter("EdgeHash.Probes"));
+#endif
+
+    // 并行构建与完全串行构建的划分结果逐位一致
+    ClusterBuildSettings sequential_settings     = settings;
+    sequential_settings.multi_threaded_threshold = ~0u;
+
+    std::vector<Cluster> sequential_clusters;
+    ClusterPartition     sequential_partition;
+    ClusterTriangles(
+        mesh.verts,
+        mesh.indices,
+        mesh.material_indexes,
+        sequential_clusters,
+        mesh.bounds,
+        sequential_settings,
+        &sequential_partition
+    );
+    CHECK(sequential_partition.GetFingerprint() == partition.GetFingerprint());
+
+    // 排序方式的边匹配与哈希方式的结果一致
+    ClusterBuildSettings sort_settings = settings;
+    sort_settings.edge_engine          = EdgeMatchEngine::Sort;
+
+    BuildStats           sort_stats;
+    std::vector<Cluster> sort_clusters;
+    ClusterPartition     sort_partition;
+    ClusterTriangles(
+        mesh.verts,
+        mesh.indices,
+        mesh.material_indexes,
+        sort_clusters,
+        mesh.bounds,
+        sort_settings,
+        &sort_partition,
+        &sort_stats
+    );
+    CHECK(sort_partition.GetFingerprint() == partition.GetFingerprint());
+    CHECK(sort_stats.GetCounter("LocalityLinks.Count") == stats.GetCounter("LocalityLinks.Count"));
+    sort_stats.Print(std::cout);
+
+    // 网格方式的局部连接同样覆盖所有三角形，比较两种方式得到的cluster包围盒的总表面积
+    ClusterBuildSettings grid_settings = settings;
+    grid_settings.locality_search      = LocalityLinkSearch::Grid;
+
+    std::vector<Cluster> grid_clusters;
+    ClusterTriangles(mesh.verts, mesh.indices, mesh.material_indexes, grid_clusters, mesh.bounds, grid_settings);
+
+    uint32 num_grid_tris = 0;
+    double window_area   = 0.0;
+    double grid_area     = 0.0;
+    for (const auto& cluster: grid_clusters) {
+        CHECK(cluster.NumTris <= uint32(grid_settings.max_partition_size));
+        num_grid_tris += cluster.NumTris;
+        grid_area += HalfSurfaceArea(cluster.Bounds);
+    }
+    for (const auto& cluster: clusters) {
+        window_area += HalfSurfaceArea(cluster.Bounds);
+    }
+    CHECK(num_grid_tris == mesh.NumTriangles());
+    std::cout << "Locality links: window area " << window_area << ", grid area " << grid_area << "\n";
+
+    // 材质接缝代价和材质数限制：每个cluster只有一种材质，所有三角形仍然恰好出现一次
+    ClusterBuildSettings material_settings  = settings;
+    material_settings.material_seam_cost    = 65;
+    material_settings.max_cluster_materials = 1;
+
+    std::vector<Cluster> material_clusters;
+    ClusterPartition     material_partition;
+    ClusterTriangles(
+        mesh.verts,
+        mesh.indices,
+        mesh.material_indexes,
+        material_clusters,
+        mesh.bounds,
+        material_settings,
+        &material_partition
+    );
+
+    std::vector<uint32> material_tri_counts(mesh.NumTriangles(), 0);
+    for (uint32 index: material_partition.indices) {
+        material_tri_counts[index]++;
+    }
+    CHECK(std::all_of(material_tri_counts.begin(), material_tri_counts.end(), [](uint32 c) { return c == 1; }));
+
+    const ClusterMaterialReport material_report_before = ComputeClusterMaterialReport(clusters.data(), clusters.size());
+    const ClusterMaterialReport material_report_after =
+        ComputeClusterMaterialReport(material_clusters.data(), material_clusters.size());
+    CHECK(material_report_after.max_materials == 1);
+    std::cout << "Materials per cluster " << material_report_before.GetAverageMaterials() << " -> "
+              << material_report_after.GetAverageMaterials() << " (" << material_clusters.size() << " clusters)\n";
+
+    // 划分质量指标：直方图覆盖所有cluster，材质接缝处切开的边更多
+    const PartitionMetrics metrics = ComputePartitionMetrics(
+        MakeConstStridedView(mesh.verts.Positions),
+        std::span<const uint32>(mesh.indices),
+        std::span<const int32>(mesh.material_indexes),
+        partition,
+        settings,
+        stats.GetCounter("LocalityLinks.Count")
+    );
+    const PartitionMetrics material_metrics = ComputePartitionMetrics(
+        MakeConstStridedView(mesh.verts.Positions),
+        std::span<const uint32>(mesh.indices),
+        std::span<const int32>(mesh.material_indexes),
+        material_partition,
+        material_settings
+    );
+    uint32 num_histogram_clusters = 0;
+    for (uint32 count: metrics.size_histogram) {
+        num_histogram_clusters += count;
+    }
+    CHECK(num_histogram_clusters == metrics.num_clusters);
+    CHECK(metrics.num_clusters == clusters.size() && metrics.num_locality_links > 0);
+    CHECK(metrics.num_cut_edges > 0 && metrics.edge_cut_weight >= metrics.num_cut_edges);
+    CHECK(material_metrics.num_cut_edges >= metrics.num_cut_edges);
+    metrics.WriteJson(std::cout);
+
+    char fingerprint[17];
+    std::snprintf(fingerprint, sizeof(fingerprint), "%016llx", (unsigned long long)partition.GetFingerprint());
+    std::cout << "Fingerprint " << fingerprint << "\n";
+
+    // 交错顶点格式和16位索引直接构建，结果与拷贝出的位置数组一致
+    struct InterleavedVertex {
+        Point3f position;
+        float   uv[2];
+    };
+    std::vector<InterleavedVertex> interleaved_verts(mesh.verts.Positions.size());
+    for (size_t i = 0; i < interleaved_verts.size(); i++) {
+        interleaved_verts[i] = { mesh.verts.Positions[i], { 0.0f, 0.0f } };
+    }
+    CHECK(interleaved_verts.size() <= 65536);
+    std::vector<uint16> indices16(mesh.indices.begin(), mesh.indices.end());
+
+    std::vector<Cluster> view_clusters;
+    ClusterPartition     view_partition;
+    ClusterTriangles(
+        MakeConstStridedView(interleaved_verts, &InterleavedVertex::position),
+        std::span<const uint16>(indices16),
+        std::span<const int32>(mesh.material_indexes),
+        view_clusters,
+        mesh.bounds,
+        settings,
+        &view_partition
+    );
+    CHECK(view_partition.indices == partition.indices);
+
+    // 顶点缓存优化只改变cluster内三角形和顶点的顺序
+    std::vector<Cluster> optimized_clusters = clusters;
+    VertexCacheReport    vertex_cache_report =
+        OptimizeClusterVertexCache(optimized_clusters.data(), optimized_clusters.size());
+    for (size_t i = 0; i < clusters.size(); i++) {
+        CHECK(optimized_clusters[i].NumVerts == clusters[i].NumVerts);
+        CHECK(optimized_clusters[i].NumTris == clusters[i].NumTris);
+    }
+    CHECK(vertex_cache_report.misses_after <= vertex_cache_report.misses_before);
+    std::cout << "ACMR " << vertex_cache_report.GetACMRBefore() << " -> " << vertex_cache_report.GetACMRAfter() << "\n";
+
+    // meshlet模式下每个cluster同时满足三角形数和顶点数的限制，所有三角形都被划分
+    ClusterBuildSettings meshlet_settings = ClusterBuildSettings::Meshlet(64, 124);
+    std::vector<Cluster> meshlets;
+    ClusterTriangles(mesh.verts, mesh.indices, mesh.material_indexes, meshlets, mesh.bounds, meshlet_settings);
+
+    uint32 num_meshlet_tris = 0;
+    for (const auto& meshlet: meshlets) {
+        CHECK(meshlet.NumVerts <= meshlet_settings.max_cluster_vertices);
+        CHECK(meshlet.NumTris <= uint32(meshlet_settings.max_partition_size));
+        num_meshlet_tris += meshlet.NumTris;
+    }
+    CHECK(num_meshlet_tris == mesh.NumTriangles());
+    std::cout << "Meshlets " << meshlets.size() << " (" << double(num_meshlet_tris) / meshlets.size() << " tris)\n";
+
+    // 编码后拓扑和材质无损，位置误差不超过半个量化步长，SIMD解码与标量解码逐位一致
+    EncodedClusters      encoded = EncodeClusters(clusters.data(), clusters.size());
+    std::vector<Cluster> decoded_clusters;
+    DecodeClusters(encoded, decoded_clusters);
+
+    const float max_position_error = 0.5f * std::ldexp(1.0f, -encoded.settings.position_precision) + 1e-5f;
+    uint64      raw_size           = 0;
+    for (size_t i = 0; i < clusters.size(); i++) {
+        CHECK(decoded_clusters[i].Indexes == clusters[i].Indexes);
+        CHECK(decoded_clusters[i].MaterialIndexes == clusters[i].MaterialIndexes);
+        for (size_t k = 0; k < clusters[i].Verts.size(); k++) {
+            CHECK(std::abs(decoded_clusters[i].Verts[k] - clusters[i].Verts[k]) <= max_position_error);
+        }
+
+        std::vector<float> scalar_positions(clusters[i].Verts.size());
+        DecodeClusterPositionsScalar(
+            encoded.GetClusterData(uint32(i)),
+            encoded.headers[i],
+            encoded.settings.position_precision,
+            scalar_positions.data()
+        );
+        CHECK(scalar_positions == decoded_clusters[i].Verts);
+
+        raw_size += (clusters[i].Verts.size() + clusters[i].Indexes.size()) * sizeof(float) +
+                    clusters[i].MaterialIndexes.size() * sizeof(int32);
     }
+    std::cout << "Encoded " << encoded.GetBytesPerTriangle() << " bytes/tri, raw "
+              << double(raw_size) / encoded.num_tris << " bytes/tri\n";
 
-    // 初始化图划分器
-    GraphPartitioner partitioner(num_triangles, Cluster::ClusterSize - 4, Cluster::ClusterSize);
+    // 分页：每4个cluster模拟一个组，所有页解码后按打包顺序还原，与直接解码的结果完全一致
+    std::vector<uint32> cluster_groups(clusters.size());
+    for (size_t i = 0; i < clusters.size(); i++) {
+        cluster_groups[i] = static_cast<uint32>(i / 4);
+    }
+
+    ClusterPageSettings page_settings;
+    page_settings.page_size = 16 * 1024;
+
+    const ClusterPageLayout     page_layout = PackClusterPages(clusters.data(), encoded, cluster_groups, page_settings);
+    const std::filesystem::path page_path   = std::filesystem::temp_directory_path() / "NaniteSelfCheck.pages";
+    CHECK(WriteClusterPages(page_path, encoded, page_layout));
     {
-        // 获取三角形的中心坐标
-        auto GetCenter = [&verts, &indices](uint32 tri_index) {
-            Point3f center;
-            center = verts.Positions[indices[tri_index * 3 + 0]];
-            center += verts.Positions[indices[tri_index * 3 + 1]];
-            center += verts.Positions[indices[tri_index * 3 + 2]];
-            return center * (1.0f / 3.0f);
-        };
-
-        // 建立邻接关系
-        partitioner.BuildLocalityLinks(disjoint_set, mesh_bounds, material_indexes, GetCenter);
-
-        // restrict 保证只有这个指针指向这块内存，方便编译器优化，若违反则可能导致未定义行为
-        auto* RESTRICT graph = partitioner.NewGraph(num_triangles * 3);
-
-        // 遍历每个三角形
-        for (uint32 i = 0; i < num_triangles; i++) {
-            graph->adjacency_offset[i] = graph->adjacency.size(); // 设置邻接表偏移量
-            uint32 tri_index           = partitioner.indices[i]; // 获取三角形索引
-            // 遍历三角形的三个边
-            for (int k = 0; k < 3; k++) {
-                // 遍历边的所有邻接边
-                adjacency.ForAll(tri_index * 3 + k, [&partitioner, graph](int32 edge_index, int32 adj_index) {
-                    partitioner.AddAdjaceny(graph, adj_index / 3, 4 * 65); // 将邻接边所在的三角形索引添加到邻接三角形
-                });
+        MappedClusterPages pages;
+        CHECK(pages.Open(page_path));
+        CHECK(pages.view.Pages().size() > 1);
+
+        std::vector<Cluster> paged_clusters;
+        for (uint32 page_index = 0; page_index < pages.view.Pages().size(); page_index++) {
+            CHECK(pages.view.GetPageOffset(page_index) % page_settings.page_size == 0);
+            for (uint32 dependency: pages.view.GetDependencies(page_index)) {
+                CHECK(dependency != page_index && dependency < pages.view.Pages().size());
             }
 
-            // 将该三角形索引添加
-            partitioner.AddLocalityLinks(graph, tri_index, 1);
+            const uint8*            page      = pages.view.GetPage(page_index);
+            const ClusterPageEntry& entry     = pages.view.Pages()[page_index];
+            const int32             precision = pages.view.Header().position_precision;
+            CHECK(DecodeClusterPage(page, entry, precision, paged_clusters));
         }
 
-        // 设置最后一个三角形的邻接偏移量
-        if (num_triangles <= 0) return;
-        graph->adjacency_offset[num_triangles] = graph->adjacency.size();
+        CHECK(paged_clusters.size() == clusters.size());
+        for (size_t i = 0; i < paged_clusters.size(); i++) {
+            const Cluster& source = decoded_clusters[pages.view.ClusterOrder()[i]];
+            CHECK(paged_clusters[i].Verts == source.Verts);
+            CHECK(paged_clusters[i].Indexes == source.Indexes);
+        }
+        std::cout << "Pages " << pages.view.Pages().size() << ", fill " << page_layout.GetFillRatio() << "\n";
+    }
+    std::filesystem::remove(page_path);
 
-        // 三角形超过5000个则启用多线程划分
-        bool enable_multi_threaded = num_triangles >= 5000;
-        partitioner.ParititionStrict(graph, enable_multi_threaded);
+    // BVH：阈值调小让顶层走分箱SAH，每个cluster恰好出现一次，查询结果包含所有与之相交的cluster
+    ClusterBVHSettings bvh_settings;
+    bvh_settings.linear_threshold = 16;
 
-        CHECK(partitioner.ranges.size());
+    const ClusterBVH bvh = BuildClusterBVH(clusters.data(), clusters.size(), bvh_settings);
+    {
+        std::vector<uint32> bvh_clusters = bvh.cluster_indices;
+        std::sort(bvh_clusters.begin(), bvh_clusters.end());
+        for (size_t i = 0; i < bvh_clusters.size(); i++) {
+            CHECK(bvh_clusters[i] == i);
+        }
+
+        for (uint32 i = 0; i < clusters.size(); i++) {
+            bool found = false;
+            bvh.Query(clusters[i].Bounds, [&](uint32 cluster_index) { found |= cluster_index == i; });
+            CHECK(found);
+        }
+        std::cout << "BVH8 " << bvh.nodes.size() << " nodes\n";
     }
+
+    // 外存构建：分块数大于1时必然存在接缝，所有三角形都必须输出且每个cluster都不超过上限
+    OutOfCoreSettings out_of_core_settings;
+    out_of_core_settings.spill_directory     = std::filesystem::temp_directory_path();
+    out_of_core_settings.max_chunk_triangles = 4096;
+
+    uint32             num_out_of_core_tris = 0;
+    MeshTriangleStream stream(mesh);
+    OutOfCoreResult    out_of_core_result =
+        ClusterTrianglesOutOfCore(stream, out_of_core_settings, [&](uint32, std::vector<Cluster>& chunk_clusters) {
+            for (const auto& cluster: chunk_clusters) {
+                CHECK(cluster.NumTris <= uint32(settings.max_partition_size));
+                num_out_of_core_tris += cluster.NumTris;
+            }
+        });
+    CHECK(out_of_core_result.num_chunks > 1);
+    CHECK(out_of_core_result.num_seam_triangles > 0);
+    CHECK(num_out_of_core_tris == mesh.NumTriangles());
+
+    RunBatchSelfCheck();
+
+    std::cout << "Self check passed: " << mesh.NumTriangles() << " triangles, " << clusters.size()
+              << " clusters, cache round trip ok, out of core " << out_of_core_result.num_chunks << " chunks "
+              << out_of_core_result.num_clusters << " clusters\n";
+    return true;
 }
 
-int main() {
-    MeshBuildVertexView  verts {};
-    std::vector<uint32>  indexes {};
-    std::vector<int32>   material_indexes {};
-    std::vector<Cluster> clusters = {};
-    Bounds3f             mesh_bounds;
+int main(int argc, char** argv) {
+    // 批量构建：Nanite <目录或清单> <输出目录> [缓存目录]
+    if (argc >= 3) {
+        std::unique_ptr<ClusterCache> cache;
+        if (argc >= 4) {
+            cache = std::make_unique<ClusterCache>(argv[3]);
+        }
 
-    ClusterTriangles(verts, indexes, material_indexes, clusters, mesh_bounds);
+        BuildStats stats;
+
+        BatchBuildSettings settings;
+        settings.output_directory = argv[2];
+        settings.cache            = cache.get();
+        settings.stats            = &stats;
+
+        std::vector<BatchInput> inputs;
+        try {
+            inputs = CollectBatchInputs(argv[1]);
+        } catch (const std::exception& exception) {
+            std::cerr << exception.what() << "\n";
+            return 1;
+        }
 
-    std::cout << "Hello!\n";
-    return 0;
-}
\ No newline at end of file
+        auto results = BuildBatch(inputs, settings);
+
+        uint32 num_failed = 0;
+        for (const auto& result: results) {
+            if (!result.succeeded) {
+                std::cerr << result.source.string() << ": " << result.error << "\n";
+                num_failed++;
+            }
+        }
+        stats.Print(std::cout);
+        std::cout << "Built " << results.size() - num_failed << "/" << results.size() << " meshes\n";
+        return num_failed ? 1 : 0;
+    }
+
+    return RunSelfCheck() ? 0 : 1;
+}
@@ -9,6 +9,13 @@ add_rules("mode.debug", "mode.release")
 add_rules("plugin.compile_commands.autoupdate", {outputdir = ".vscode"})
 add_rules("plugin.vsxmake.autoupdate")
 
+option("hash_table_stats")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Record hash table chain lengths and probe counts in BuildStats")
+    add_defines("HASH_TABLE_STATS=1")
+option_end()
+
 target("Nanite")
     set_kind("binary")
 
@@ -21,4 +28,6 @@ target("Nanite")
     add_linkdirs("external/lib")
 
     add_links("METIS/metis")
+
+    add_options("hash_table_stats")
 target_end()